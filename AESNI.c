@@ -25,10 +25,8 @@
 #include <wmmintrin.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
-#if defined(HAVE__ALIGNED_MALLOC)
-#include <malloc.h>
-#endif
+
+#include "mem.h"
 
 #define MODULE_NAME _AESNI
 #define BLOCK_SIZE 16
@@ -46,34 +44,6 @@ typedef struct {
     int rounds;
 } block_state;
 
-/* Wrapper functions for malloc and free with memory alignment */
-#if defined(HAVE_ALIGNED_ALLOC) /* aligned_alloc is defined by C11 */
-# define aligned_malloc_wrapper aligned_alloc
-# define aligned_free_wrapper free
-#elif defined(HAVE_POSIX_MEMALIGN) /* posix_memalign is defined by POSIX */
-static void* aligned_malloc_wrapper(size_t alignment, size_t size)
-{
-    void* tmp = NULL;
-    int err = posix_memalign(&tmp, alignment, size);
-    if (err != 0) {
-        /* posix_memalign does NOT set errno on failure; the error is returned */
-        errno = err;
-        return NULL;
-    }
-    return tmp;
-}
-# define aligned_free_wrapper free
-#elif defined(HAVE__ALIGNED_MALLOC) /* _aligned_malloc is available on Windows */
-static void* aligned_malloc_wrapper(size_t alignment, size_t size)
-{
-    /* NB: _aligned_malloc takes its args in the opposite order from aligned_alloc */
-    return _aligned_malloc(size, alignment);
-}
-# define aligned_free_wrapper _aligned_free
-#else
-# error "No function to allocate/free aligned memory is available."
-#endif
-
 /* Helper functions to expand keys */
 
 static __m128i aes128_keyexpand(__m128i key)
@@ -196,11 +166,11 @@ void block_init_aesni(block_state* self, unsigned char* key, int keylen)
     }
 
     /* ensure that self->ek and self->dk are aligned to 16 byte boundaries */
-    void* tek = aligned_malloc_wrapper(16, (nr + 1) * sizeof(__m128i));
-    void* tdk = aligned_malloc_wrapper(16, (nr + 1) * sizeof(__m128i));
+    void* tek = xmemalign(16, (nr + 1) * sizeof(__m128i));
+    void* tdk = xmemalign(16, (nr + 1) * sizeof(__m128i));
     if (!tek || !tdk) {
-        aligned_free_wrapper(tek);
-        aligned_free_wrapper(tdk);
+        xfree(tek);
+        xfree(tdk);
         return;
     }
 
@@ -214,12 +184,17 @@ void block_init_aesni(block_state* self, unsigned char* key, int keylen)
 
 void block_finalize_aesni(block_state* self)
 {
+    if (!self->ek || !self->dk)
+        return;
+
     /* overwrite contents of ek and dk */
     memset(self->ek, 0, (self->rounds + 1) * sizeof(__m128i));
     memset(self->dk, 0, (self->rounds + 1) * sizeof(__m128i));
 
-    aligned_free_wrapper(self->ek);
-    aligned_free_wrapper(self->dk);
+    xfree(self->ek);
+    xfree(self->dk);
+    self->ek = NULL;
+    self->dk = NULL;
 }
 
 void block_encrypt_aesni(block_state* self, const u8* in, u8* out)
@@ -278,3 +253,42 @@ void block_decrypt_aesni(block_state* self, const u8* in, u8* out)
     _mm_storeu_si128((__m128i*) out, m);
 }
 
+
+/*
+ * Decrypt nblocks independent blocks (ECB), four at a time so the
+ * AESDEC latency of one block is hidden behind the others. in and out
+ * may be the same buffer.
+ */
+void block_decrypt_aesni_n(block_state* self, const u8* in, u8* out, int nblocks)
+{
+    const __m128i* dk = self->dk;
+    __m128i m0, m1, m2, m3, k;
+    int r;
+
+    for (; nblocks >= 4; nblocks -= 4, in += 4*BLOCK_SIZE, out += 4*BLOCK_SIZE) {
+        k = dk[0];
+        m0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) in), k);
+        m1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + BLOCK_SIZE)), k);
+        m2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 2*BLOCK_SIZE)), k);
+        m3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (in + 3*BLOCK_SIZE)), k);
+        for (r = 1; r < self->rounds; ++r) {
+            k = dk[r];
+            m0 = _mm_aesdec_si128(m0, k);
+            m1 = _mm_aesdec_si128(m1, k);
+            m2 = _mm_aesdec_si128(m2, k);
+            m3 = _mm_aesdec_si128(m3, k);
+        }
+        k = dk[self->rounds];
+        _mm_storeu_si128((__m128i*) out, _mm_aesdeclast_si128(m0, k));
+        _mm_storeu_si128((__m128i*) (out + BLOCK_SIZE), _mm_aesdeclast_si128(m1, k));
+        _mm_storeu_si128((__m128i*) (out + 2*BLOCK_SIZE), _mm_aesdeclast_si128(m2, k));
+        _mm_storeu_si128((__m128i*) (out + 3*BLOCK_SIZE), _mm_aesdeclast_si128(m3, k));
+    }
+
+    for (; nblocks > 0; --nblocks, in += BLOCK_SIZE, out += BLOCK_SIZE) {
+        m0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) in), dk[0]);
+        for (r = 1; r < self->rounds; ++r)
+            m0 = _mm_aesdec_si128(m0, dk[r]);
+        _mm_storeu_si128((__m128i*) out, _mm_aesdeclast_si128(m0, dk[self->rounds]));
+    }
+}
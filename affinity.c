@@ -0,0 +1,182 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE     /* cpu_set_t, pthread_setaffinity_np() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+#include "affinity.h"
+#include "batch.h"
+#include "trace.h"
+
+#ifdef __linux__
+
+static cpu_set_t allowed;
+static cpu_set_t nodecpus[AFFINITY_MAXNODES];
+static int nnodes = 0;
+static int pinned = 0;
+
+/*
+ * Parse a CPU list like "0-3,8,10-11" into set, 1 on error
+ */
+static int affinity_parse(const char *list, cpu_set_t *set)
+{
+   const char *p = list;
+   char *end;
+   long from, to;
+
+   CPU_ZERO(set);
+
+   while(*p != '\0' && *p != '\n')
+   {
+      from = strtol(p, &end, 10);
+      if(end == p || from < 0)
+         return 1;
+      to = from;
+
+      p = end;
+      if(*p == '-')
+      {
+         to = strtol(p+1, &end, 10);
+         if(end == p+1 || to < from)
+            return 1;
+         p = end;
+      }
+
+      for(; from <= to && from < CPU_SETSIZE; from++)
+         CPU_SET(from, set);
+
+      if(*p == ',')
+         p++;
+      else if(*p != '\0' && *p != '\n')
+         return 1;
+   }
+
+   return 0;
+}
+
+/*
+ * Set up the CPUs to run on, cpulist NULL for all we are allowed to.
+ * Returns 1 if cpulist is invalid or names no usable CPU.
+ */
+int affinity_init(const char *cpulist)
+{
+   char path[64], buf[1024];
+   cpu_set_t set;
+   FILE *fp;
+   int n;
+
+   if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+   {
+      CPU_ZERO(&allowed);
+      for(n=0; n < batch_ncpus() && n < CPU_SETSIZE; n++)
+         CPU_SET(n, &allowed);
+   }
+
+   if(cpulist != NULL)
+   {
+      if(affinity_parse(cpulist, &set) != 0)
+         return 1;
+
+      CPU_AND(&allowed, &allowed, &set);
+      if(CPU_COUNT(&allowed) == 0)
+         return 1;
+
+      pinned = 1;
+   }
+
+   /* node numbers may have gaps */
+   for(n=0; n < AFFINITY_MAXNODES; n++)
+   {
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+      if((fp = fopen(path, "r")) == NULL)
+         continue;
+
+      if(fgets(buf, sizeof(buf), fp) != NULL && affinity_parse(buf, &set) == 0)
+      {
+         CPU_AND(&nodecpus[nnodes], &set, &allowed);
+         if(CPU_COUNT(&nodecpus[nnodes]) > 0)
+            nnodes++;
+      }
+      fclose(fp);
+   }
+
+   if(nnodes == 0)
+   {
+      nodecpus[0] = allowed;
+      nnodes = 1;
+   }
+
+   trace(TRC_INFO, "Using %d CPUs on %d NUMA node%s", CPU_COUNT(&allowed),
+         nnodes, nnodes > 1 ? "s" : "");
+
+   return 0;
+}
+
+int affinity_ncpus(void)
+{
+   return CPU_COUNT(&allowed) > 0 ? CPU_COUNT(&allowed) : batch_ncpus();
+}
+
+int affinity_nodes(void)
+{
+   return nnodes;
+}
+
+/*
+ * Pin the calling worker to the CPUs of node id % nodes. Nothing to do
+ * on a single node unless --cpus restricted the CPUs.
+ */
+void affinity_worker(int id)
+{
+   int node;
+
+   if(nnodes < 2 && !pinned)
+      return;
+
+   node = id % nnodes;
+   if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &nodecpus[node]) != 0)
+      trace(TRC_WARN, "cannot pin worker %d to node %d", id, node);
+   else
+      trace(TRC_DEBUG, "worker %d on node %d", id, node);
+}
+
+#else
+
+int affinity_init(const char *cpulist)
+{
+   if(cpulist != NULL)
+      trace(TRC_WARN, "CPU affinity is not supported on this platform, ignoring --cpus");
+
+   return 0;
+}
+
+int affinity_ncpus(void)
+{
+   return batch_ncpus();
+}
+
+int affinity_nodes(void)
+{
+   return 1;
+}
+
+void affinity_worker(int id)
+{
+}
+
+#endif
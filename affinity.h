@@ -0,0 +1,27 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _AFFINITY_H_
+#define _AFFINITY_H_
+
+#define AFFINITY_MAXNODES  64
+
+/*
+ * Worker placement. The CPUs we may use (--cpus or the inherited
+ * affinity mask) are grouped by NUMA node and workers are spread over
+ * the nodes round robin, each pinned to the CPUs of its node. Since a
+ * worker maps and touches its buffer arena after it is pinned the
+ * buffers end up in node local memory.
+ */
+extern int affinity_init(const char *cpulist);
+extern int affinity_ncpus(void);
+extern int affinity_nodes(void);
+extern void affinity_worker(int id);
+
+#endif /* _AFFINITY_H_ */
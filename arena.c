@@ -0,0 +1,175 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#endif
+
+#include "arena.h"
+#include "mem.h"
+
+#define ARENA_PAGE  4096
+
+#ifdef LOWMEM
+static char arena_static[ARENA_STATIC] __attribute__((aligned(ARENA_PAGE)));
+#endif
+
+#ifndef _MSC_VER
+/*
+ * Map size bytes aligned to a 2M boundary and ask for transparent
+ * hugepages. The kernel only uses them for aligned 2M ranges, so the
+ * mapping is over-allocated and trimmed.
+ */
+static char *arena_map_thp(size_t size)
+{
+   char *p, *aligned;
+   size_t head, tail;
+
+   p = mmap(NULL, size + ARENA_HUGEPAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if(p == MAP_FAILED)
+      return NULL;
+
+   aligned = (char *)(((size_t)p + ARENA_HUGEPAGE-1) & ~(size_t)(ARENA_HUGEPAGE-1));
+   head = aligned - p;
+   tail = ARENA_HUGEPAGE - head;
+
+   if(head > 0)
+      munmap(p, head);
+   if(tail > 0)
+      munmap(aligned + size, tail);
+
+#ifdef MADV_HUGEPAGE
+   madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+   return aligned;
+}
+#endif
+
+/*
+ * With ARENA_HUGEPAGES the size is rounded up to full 2M pages and
+ * explicit hugepages are tried first, then transparent hugepages.
+ */
+int arena_init(struct arena *a, size_t size, int flags)
+{
+   memset(a, 0, sizeof(*a));
+
+#ifdef LOWMEM
+   /* one fixed working set, hugepages make no sense here */
+   if(size > sizeof(arena_static))
+      return 1;
+
+   a->base = arena_static;
+   a->size = sizeof(arena_static);
+   a->pages = ARENA_SMALLPAGES;
+
+   return 0;
+#endif
+
+   if(flags & ARENA_HUGEPAGES)
+      size = (size + ARENA_HUGEPAGE-1) & ~(size_t)(ARENA_HUGEPAGE-1);
+   else
+      size = (size + ARENA_PAGE-1) & ~(size_t)(ARENA_PAGE-1);
+
+#ifdef _MSC_VER
+   a->base = xmemalign(ARENA_PAGE, size);
+   if(a->base == NULL)
+      return 1;
+#else
+   a->base = NULL;
+   a->pages = ARENA_SMALLPAGES;
+
+   if(flags & ARENA_HUGEPAGES)
+   {
+#ifdef MAP_HUGETLB
+      a->base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(a->base == MAP_FAILED)
+         a->base = NULL;
+      else
+         a->pages = ARENA_HUGETLB;
+#endif
+      if(a->base == NULL && (a->base = arena_map_thp(size)) != NULL)
+         a->pages = ARENA_THP;
+   }
+
+   if(a->base == NULL)
+   {
+      a->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(a->base == MAP_FAILED)
+      {
+         a->base = NULL;
+         return 1;
+      }
+   }
+
+   pthread_mutex_lock(&memstats_lock);
+   memstats.allocated += size;
+   memstats.allocs++;
+   pthread_mutex_unlock(&memstats_lock);
+#endif
+
+   a->size = size;
+
+   /* fault in all pages now instead of once per file */
+   if(!(flags & ARENA_LAZY))
+      memset(a->base, 0, size);
+
+   return 0;
+}
+
+void arena_destroy(struct arena *a)
+{
+   if(a->base == NULL)
+      return;
+
+#ifdef LOWMEM
+   memset(a, 0, sizeof(*a));
+   return;
+#endif
+
+#ifdef _MSC_VER
+   xfree(a->base);
+#else
+   munmap(a->base, a->size);
+   pthread_mutex_lock(&memstats_lock);
+   memstats.frees++;
+   pthread_mutex_unlock(&memstats_lock);
+#endif
+
+   memset(a, 0, sizeof(*a));
+}
+
+/*
+ * Returns NULL if the arena is exhausted, the caller falls back to the
+ * heap then. Memory is never given back individually, only by
+ * arena_reset().
+ */
+void *arena_alloc(struct arena *a, size_t align, size_t size)
+{
+   size_t off;
+
+   if(a->base == NULL)
+      return NULL;
+
+   off = (a->used + align-1) & ~(align-1);
+   if(off + size > a->size)
+      return NULL;
+
+   a->used = off + size;
+
+   return a->base + off;
+}
+
+void arena_reset(struct arena *a)
+{
+   a->used = 0;
+}
@@ -0,0 +1,56 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#ifdef LOWMEM
+#define ARENA_SIZE      (4*1024)    /* on top of the packet buffer */
+#define ARENA_STATIC    (40*1024)   /* static backing, no mmap() */
+#else
+#define ARENA_SIZE      (64*1024)   /* on top of the packet buffer */
+#endif
+#define ARENA_HUGEPAGE  (2*1024*1024)
+
+/* flags for arena_init() */
+#define ARENA_HUGEPAGES 0x01
+#define ARENA_LAZY      0x02   /* do not fault in all pages up front */
+
+/* kind of pages backing the arena */
+enum {
+   ARENA_SMALLPAGES = 0,
+   ARENA_HUGETLB,       /* explicit hugepages via MAP_HUGETLB */
+   ARENA_THP            /* transparent hugepages via madvise() */
+};
+
+/*
+ * Bump allocator for everything that lives as long as one file: I/O
+ * buffer and key schedule. It is mapped and touched once per worker
+ * and reset between files, so steady state processing neither calls
+ * malloc() nor takes first-touch page faults.
+ */
+struct arena
+{
+   char *base;
+   size_t size;
+   size_t used;
+   int pages;
+};
+
+extern int arena_init(struct arena *a, size_t size, int flags);
+extern void arena_destroy(struct arena *a);
+extern void *arena_alloc(struct arena *a, size_t align, size_t size);
+extern void arena_reset(struct arena *a);
+
+#define arena_owns(a, p) \
+   ((a)->base != NULL && (char *)(p) >= (a)->base && (char *)(p) < (a)->base + (a)->size)
+
+#endif /* _ARENA_H_ */
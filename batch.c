@@ -0,0 +1,489 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _MSC_VER
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "batch.h"
+#include "claim.h"
+#include "iosched.h"
+#include "journal.h"
+#include "mem.h"
+#include "stats.h"
+#include "trace.h"
+
+#ifdef LOWMEM
+static struct mentry batch_ring[BATCH_AHEAD];
+#endif
+
+/*
+ * Number of online CPUs, at least 1
+ */
+int batch_ncpus(void)
+{
+#ifdef _MSC_VER
+   SYSTEM_INFO si;
+   GetSystemInfo(&si);
+   return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+#else
+   long n = sysconf(_SC_NPROCESSORS_ONLN);
+   return n > 0 ? (int)n : 1;
+#endif
+}
+
+void batch_init(struct batch *b, char **files, int nfiles)
+{
+   memset(b, 0, sizeof(*b));
+   b->files = files;
+   b->nfiles = nfiles;
+   b->active = nfiles;
+   pthread_mutex_init(&b->lock, NULL);
+   pthread_cond_init(&b->cond, NULL);
+
+   stats_queue(nfiles);
+}
+
+struct batch_addr
+{
+   unsigned long long dev;
+   unsigned long long addr;
+   int idx;
+   char *file;
+};
+
+static int batch_cmp_addr(const void *a, const void *b)
+{
+   const struct batch_addr *x = a, *y = b;
+
+   if(x->dev != y->dev)
+      return x->dev < y->dev ? -1 : 1;
+   if(x->addr != y->addr)
+      return x->addr < y->addr ? -1 : 1;
+   return x->idx - y->idx;
+}
+
+/*
+ * Order the files by device and physical address of their first block
+ * so a batch on one disk is read in a single sweep. Files whose
+ * address is unknown count as address 0, so they keep their order at
+ * the start of their device's group; files that cannot be opened have
+ * no device either and come first of all.
+ */
+void batch_sort_physical(struct batch *b)
+{
+   struct batch_addr *ba;
+   int i, known = 0;
+
+   if(b->nfiles < 2)
+      return;
+
+   if((ba = (struct batch_addr *)xmalloc(b->nfiles * sizeof(*ba))) == NULL)
+      return;
+
+   for(i=0; i < b->nfiles; i++)
+   {
+      if(iosched_fileaddr(b->files[i], &ba[i].dev, &ba[i].addr) == 0)
+         known++;
+      ba[i].idx = i;
+      ba[i].file = b->files[i];
+   }
+
+   qsort(ba, b->nfiles, sizeof(*ba), batch_cmp_addr);
+
+   for(i=0; i < b->nfiles; i++)
+      b->files[i] = ba[i].file;
+
+   xfree(ba);
+
+   trace(TRC_INFO, "Sorted %d files by physical address, %d unknown",
+         b->nfiles, b->nfiles - known);
+}
+
+/*
+ * Adaptive worker count. Every BATCH_INTERVAL the controller looks at
+ * throughput and where the workers spent their time, from the stage
+ * latency sums:
+ *
+ * - after adding a worker that did not raise throughput by 5% or
+ *   removing one that cost more than 5% the step is undone and the
+ *   count held for BATCH_HOLD intervals
+ * - workers mostly decrypting (CPU bound) get company
+ * - workers mostly waiting for read and write (I/O bound) are reduced,
+ *   more of them would only add seeks and contention
+ */
+static void *batch_control(void *arg)
+{
+   struct batch *b = arg;
+   struct stats s;
+   struct timespec ts;
+   unsigned long long bytes = 0;
+   double cpu = 0, io = 0, t, now, rate, lastrate = 0, busy;
+   int move = 0, hold = 0, max = b->active;
+
+   stats_read(&s);
+   bytes = s.bytes_read;
+   cpu = s.lat[LAT_DECRYPT].sum;
+   io = s.lat[LAT_READ].sum + s.lat[LAT_WRITE].sum;
+   t = stats_now();
+
+   pthread_mutex_lock(&b->lock);
+   b->active = 1;
+   clock_gettime(CLOCK_REALTIME, &ts);
+
+   while(!b->stop)
+   {
+      /* every worker broadcast on the shared cond wakes us too, only
+         the deadline ends the interval */
+      ts.tv_sec += (time_t)BATCH_INTERVAL;
+      while(!b->stop && pthread_cond_timedwait(&b->cond, &b->lock, &ts) != ETIMEDOUT)
+         ;
+      if(b->stop)
+         break;
+
+      pthread_mutex_unlock(&b->lock);
+
+      stats_read(&s);
+      now = stats_now();
+
+      pthread_mutex_lock(&b->lock);
+
+      rate = (s.bytes_read - bytes) / (now - t);
+      busy = (now - t) * (b->running > 0 ? b->running : 1);
+      cpu = (s.lat[LAT_DECRYPT].sum - cpu) / busy;
+      io = (s.lat[LAT_READ].sum + s.lat[LAT_WRITE].sum - io) / busy;
+
+      if(move > 0 && rate < lastrate * 1.05)
+      {
+         b->active--;
+         move = 0;
+         hold = BATCH_HOLD;
+      }
+      else if(move < 0 && rate < lastrate * 0.95)
+      {
+         b->active++;
+         move = 0;
+         hold = BATCH_HOLD;
+      }
+      else if(hold > 0)
+      {
+         hold--;
+         move = 0;
+      }
+      else if(cpu > 0.5 && b->active < max)
+      {
+         b->active++;
+         move = 1;
+      }
+      else if(io > 0.8 && b->active > 1)
+      {
+         b->active--;
+         move = -1;
+      }
+      else
+         move = 0;
+
+      trace(TRC_DEBUG, "controller: %.1f MB/s, cpu %.0f%%, io %.0f%%, %d workers",
+            rate / 1e6, cpu * 100, io * 100, b->active);
+
+      /* waiting workers may start on a file now */
+      pthread_cond_broadcast(&b->cond);
+
+      lastrate = rate;
+      bytes = s.bytes_read;
+      cpu = s.lat[LAT_DECRYPT].sum;
+      io = s.lat[LAT_READ].sum + s.lat[LAT_WRITE].sum;
+      t = now;
+   }
+
+   pthread_mutex_unlock(&b->lock);
+
+   trace(TRC_INFO, "controller finished with %d workers", b->active);
+
+   return NULL;
+}
+
+/* files left to hand out, called with the lock held */
+static int batch_more(struct batch *b)
+{
+   return b->ahead_count > 0 || !b->ahead_done;
+}
+
+/*
+ * Skip files a previous run has finished
+ */
+static int batch_skip(struct batch *b, const char *file)
+{
+   struct jentry *e;
+
+   if(!b->journal || (e = journal_lookup(file)) == NULL || e->state != JR_DONE)
+      return 0;
+
+   trace(TRC_INFO, "%s is done according to the journal, skipped", file);
+
+   return 1;
+}
+
+/*
+ * Next file from the sources, filled into e. Files from the command
+ * line come first, then the entries of the manifest as they are read
+ * and the files found by the -r walk. Every file counts in the queue
+ * depth from when it is known until a worker takes it. Called with
+ * the lock held, which is dropped while reading the manifest or
+ * waiting for the walk.
+ */
+static int batch_fetch(struct batch *b, struct mentry *e)
+{
+   int more;
+
+   if(b->next < b->nfiles)
+   {
+      memset(e, 0, sizeof(*e));
+      snprintf(e->file, sizeof(e->file), "%s", b->files[b->next++]);
+      return 1;
+   }
+
+   /* only the read ahead thread reads the manifest, a slow pipe must
+      not keep the workers from the entries already read ahead. The
+      read is the one place batch_stop() may cancel the thread, so a
+      pipe that never closes cannot hang the shutdown. */
+   if(b->manifest != NULL)
+   {
+      b->ahead_reading = 1;
+      pthread_mutex_unlock(&b->lock);
+      pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+      more = manifest_next(b->manifest, e);
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+      pthread_mutex_lock(&b->lock);
+      b->ahead_reading = 0;
+      if(more)
+      {
+         stats_queue(1);
+         return 1;
+      }
+      b->manifest = NULL;
+   }
+
+   if(b->walk != NULL)
+   {
+      pthread_mutex_unlock(&b->lock);
+      if(walk_next(b->walk, e))
+      {
+         pthread_mutex_lock(&b->lock);
+         return 1;
+      }
+      pthread_mutex_lock(&b->lock);
+      b->walk = NULL;
+   }
+
+   return 0;
+}
+
+/*
+ * Read ahead thread. Entries are fetched straight into the free slot
+ * after the ring, which only becomes visible to the workers once the
+ * metadata is read.
+ */
+static void *batch_ahead(void *arg)
+{
+   struct batch *b = arg;
+   struct mentry *e;
+
+   pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+   pthread_mutex_lock(&b->lock);
+
+   for(;;)
+   {
+      while(b->ahead_count == BATCH_AHEAD && !b->failed && !b->stop)
+         pthread_cond_wait(&b->cond, &b->lock);
+
+      e = &b->ahead[(b->ahead_head + b->ahead_count) % BATCH_AHEAD];
+      if(b->failed || b->stop || !batch_fetch(b, e))
+         break;
+
+      pthread_mutex_unlock(&b->lock);
+
+      if(batch_skip(b, e->file))
+      {
+         stats_queue(-1);
+         pthread_mutex_lock(&b->lock);
+         continue;
+      }
+      decrypt_readmeta(&e->meta, e->file, e->paired ? e->mdbfile : NULL,
+         e->paired ? e->inffile : NULL);
+
+      pthread_mutex_lock(&b->lock);
+      b->ahead_count++;
+      pthread_cond_broadcast(&b->cond);
+   }
+
+   b->ahead_done = 1;
+   pthread_cond_broadcast(&b->cond);
+   pthread_mutex_unlock(&b->lock);
+
+   return NULL;
+}
+
+/*
+ * Next file to decrypt, filled into e. NULL when the batch is done or
+ * has failed. Files claimed by other processes are skipped.
+ */
+struct mentry *batch_next(struct batch *b, struct mentry *e)
+{
+   for(;;)
+   {
+      pthread_mutex_lock(&b->lock);
+
+      while(!b->failed && batch_more(b) && (b->running >= b->active || b->ahead_count == 0))
+         pthread_cond_wait(&b->cond, &b->lock);
+
+      if(b->failed || b->ahead_count == 0)
+      {
+         pthread_mutex_unlock(&b->lock);
+         return NULL;
+      }
+
+      memcpy(e, &b->ahead[b->ahead_head], sizeof(*e));
+      b->ahead_head = (b->ahead_head + 1) % BATCH_AHEAD;
+      b->ahead_count--;
+      b->running++;
+      stats_queue(-1);
+      pthread_cond_broadcast(&b->cond);
+      pthread_mutex_unlock(&b->lock);
+
+      if(!b->claim || claim_acquire(e->file, &e->lost) == 0)
+         return e;
+
+      pthread_mutex_lock(&b->lock);
+      b->running--;
+      pthread_cond_broadcast(&b->cond);
+      pthread_mutex_unlock(&b->lock);
+   }
+}
+
+/*
+ * The workers are done, stop the read ahead and the controller. A read
+ * ahead still waiting for a manifest line is cancelled.
+ */
+static void batch_stop(struct batch *b, pthread_t ahead)
+{
+   pthread_mutex_lock(&b->lock);
+   b->stop = 1;
+   if(b->ahead_reading)
+      pthread_cancel(ahead);
+   pthread_cond_broadcast(&b->cond);
+   pthread_mutex_unlock(&b->lock);
+
+   pthread_join(ahead, NULL);
+#ifndef LOWMEM
+   free(b->ahead);
+#endif
+   b->ahead = NULL;
+}
+
+/*
+ * Run worker on workers threads and wait for all of them. A single
+ * worker runs on the calling thread. Returns 0 if no file failed.
+ */
+int batch_run(struct batch *b, int workers, void *(*worker)(void *))
+{
+   pthread_t *tids, ctl, ahead;
+   int i, started, control = 0;
+
+   /* the size of a manifest or walk is not known up front */
+   if(workers > b->nfiles && b->manifest == NULL && b->walk == NULL)
+      workers = b->nfiles;
+
+   b->active = workers > 1 ? workers : 1;
+
+#ifdef LOWMEM
+   b->ahead = batch_ring;
+#else
+   b->ahead = calloc(BATCH_AHEAD, sizeof(*b->ahead));
+#endif
+   if(b->ahead == NULL || pthread_create(&ahead, NULL, batch_ahead, b) != 0)
+   {
+      trace(TRC_ERROR, "Cannot start read ahead");
+#ifndef LOWMEM
+      free(b->ahead);
+#endif
+      return 1;
+   }
+
+   if(workers <= 1 || (tids = calloc(workers, sizeof(*tids))) == NULL)
+   {
+      worker(b);
+      batch_stop(b, ahead);
+      return b->failed;
+   }
+
+   if(b->adaptive)
+      control = (pthread_create(&ctl, NULL, batch_control, b) == 0);
+
+   for(started=0; started < workers; started++)
+   {
+      if(pthread_create(&tids[started], NULL, worker, b) != 0)
+      {
+         trace(TRC_WARN, "cannot start worker %d, running with %d", started+1, started);
+         break;
+      }
+   }
+
+   if(started == 0)
+      worker(b);
+
+   for(i=0; i < started; i++)
+      pthread_join(tids[i], NULL);
+
+   free(tids);
+
+   batch_stop(b, ahead);
+   if(control)
+      pthread_join(ctl, NULL);
+
+   return b->failed;
+}
+
+/*
+ * The file from batch_next() is finished. A failed file stops the
+ * batch.
+ */
+void batch_done(struct batch *b, const char *file, int failed)
+{
+   if(b->claim)
+      claim_release(file, failed);
+
+   pthread_mutex_lock(&b->lock);
+   b->running--;
+   if(failed)
+      b->failed = 1;
+   pthread_cond_broadcast(&b->cond);
+   pthread_mutex_unlock(&b->lock);
+}
+
+/*
+ * Number the calling worker, 0 for the first
+ */
+int batch_worker_id(struct batch *b)
+{
+   int id;
+
+   pthread_mutex_lock(&b->lock);
+   id = b->workers++;
+   pthread_mutex_unlock(&b->lock);
+
+   return id;
+}
@@ -0,0 +1,74 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <pthread.h>
+
+#include "manifest.h"
+#include "walk.h"
+
+/*
+ * Files given on the command line, entries of a job manifest and files
+ * found by the -r walk are handed out to a pool of worker threads, each
+ * decrypting one whole file at a time. The manifest is read and the
+ * walk waited for as the workers need entries. A failed file
+ * stops the batch like it does in sequential mode; files already
+ * being decrypted are finished.
+ *
+ * A read ahead thread takes the next BATCH_AHEAD files from these
+ * sources and reads their .mdb and .inf while the workers decrypt, so
+ * a worker starts on its next file without waiting for metadata.
+ * Files the journal lists as done are skipped there.
+ *
+ * With adaptive set a controller thread decides how many of the
+ * workers may decrypt at the same time, see batch_control().
+ */
+#define BATCH_INTERVAL  2.0   /* seconds between controller decisions */
+#define BATCH_HOLD      5     /* intervals to stay after a failed probe */
+#ifdef LOWMEM
+#define BATCH_AHEAD     1     /* files read ahead, static for the one worker */
+#else
+#define BATCH_AHEAD     8     /* files read ahead */
+#endif
+
+struct batch
+{
+   char **files;
+   int nfiles;
+   int next;                  /* next file to hand out */
+   int failed;
+   int running;               /* files being decrypted */
+   int active;                /* files allowed to be decrypted at once */
+   int adaptive;
+   int stop;                  /* all workers are done */
+   int workers;               /* workers started, for their ids */
+   int claim;                 /* claim files through claim.h first */
+   int journal;               /* skip files done according to journal.h */
+   struct manifest *manifest; /* more jobs after files, NULL at its end */
+   struct walk *walk;         /* and after the manifest, NULL at its end */
+   struct mentry *ahead;      /* ring of files read ahead */
+   int ahead_head;
+   int ahead_count;
+   int ahead_done;            /* no more files to read ahead */
+   int ahead_reading;         /* read ahead is in manifest_next() */
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+};
+
+extern int batch_ncpus(void);
+extern void batch_init(struct batch *b, char **files, int nfiles);
+extern void batch_sort_physical(struct batch *b);
+extern int batch_run(struct batch *b, int workers, void *(*worker)(void *));
+extern struct mentry *batch_next(struct batch *b, struct mentry *e);
+extern void batch_done(struct batch *b, const char *file, int failed);
+extern int batch_worker_id(struct batch *b);
+
+#endif /* _BATCH_H_ */
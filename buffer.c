@@ -7,9 +7,15 @@
  * of the GPL v2 license.  See the LICENSE file for details.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE     /* sync_file_range() */
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -21,25 +27,65 @@ typedef unsigned int ssize_t;
 #endif
 
 #include "buffer.h"
+#include "iosched.h"
+#include "throttle.h"
+#include "trace.h"
+#include "tracering.h"
+#include "probes.h"
+#include "stats.h"
+#include "mem.h"
+#include "journal.h"
 
-int pbinit(struct packetbuffer *pb)
+/*
+ * Set up a buffer that reads and writes in chunks of iosize bytes. It
+ * holds two chunks plus one packet for the bytes carried over between
+ * two pbwrite() calls. With a buffer budget iosize is lowered to what
+ * the share of this file allows, down to READSIZE.
+ */
+int pbinit(struct packetbuffer *pb, size_t iosize)
 {
+   size_t io;
+
    if(pb == NULL)
       return 1;
 
    pbfree(pb);
 
-   pb->buffer = (char *)malloc(BUFFERSIZE);
+   pb->reserved = mem_reserve(PBSIZE(iosize), PBSIZE(READSIZE));
+   if(pb->reserved < PBSIZE(iosize))
+   {
+      io = ((pb->reserved - PACKETSIZE) / 2) & ~(size_t)(PBALIGN-1);
+      iosize = io > READSIZE ? io : READSIZE;
+      trace(TRC_DEBUG, "buffer budget share %lu bytes, I/O size %lu",
+            (unsigned long)pb->reserved, (unsigned long)iosize);
+   }
+
+   pb->iosize = iosize;
+   pb->size = PBSIZE(iosize);
+   pb->buffer = (char *)xmemalign(PBALIGN, pb->size);
    if(pb->buffer == NULL){
       printf("malloc failed\n");
+      mem_release(pb->reserved);
+      pb->reserved = 0;
       return 1;
    }
-   memset(pb->buffer, 0, BUFFERSIZE);
 
+   /* the data is never read before read() filled it, only the state
+      is reset, so a fresh arena is not touched page by page here */
    pb->startp = pb->buffer;
    pb->workp = pb->buffer;
    pb->endp = pb->buffer;
    pb->end = 0;
+   pb->rdbytes = 0;
+   pb->wrbytes = 0;
+   pb->dropcache = 0;
+   pb->rddropped = 0;
+   pb->wrflushed = 0;
+   pb->wrdropped = 0;
+   pb->dev = NULL;
+   pb->map = NULL;
+   pb->hash = NULL;
+   pb->error = 0;
 
    return 0;
 }
@@ -49,9 +95,22 @@ int pbfree(struct packetbuffer *pb)
    if(pb == NULL)
       return 1;
 
+   if(pb->map != NULL)
+      xfree(pb->map);
+   pb->map = NULL;
+
    if(pb->buffer != NULL)
-      free(pb->buffer);
-   
+   {
+      if(membudget > 0)
+         mem_discard(pb->buffer, pb->size);
+      xfree(pb->buffer);
+   }
+
+   if(pb->reserved > 0)
+      mem_release(pb->reserved);
+   pb->reserved = 0;
+
+   pb->buffer = NULL;
    pb->startp = NULL;
    pb->workp = NULL;
    pb->endp = NULL;
@@ -60,40 +119,192 @@ int pbfree(struct packetbuffer *pb)
    return 0;
 }
 
+/*
+ * Keep the page cache from growing while streaming through large
+ * files. Input pages are dropped once consumed. Output pages can only
+ * be dropped after writeback, so writeback of each new range is
+ * started and the previous range, which is on disk by then, dropped.
+ */
+static void pbdropcache(struct packetbuffer *pb, int final)
+{
+#ifdef POSIX_FADV_DONTNEED
+   if(pb->rdbytes - pb->rddropped >= DROPCACHE_CHUNK || (final && pb->rdbytes > pb->rddropped))
+   {
+      posix_fadvise(pb->fdread, pb->rddropped, pb->rdbytes - pb->rddropped, POSIX_FADV_DONTNEED);
+      pb->rddropped = pb->rdbytes;
+   }
+
+   if(pb->wrbytes - pb->wrflushed >= DROPCACHE_CHUNK || (final && pb->wrbytes > pb->wrflushed))
+   {
+#ifdef SYNC_FILE_RANGE_WRITE
+      sync_file_range(pb->fdwrite, pb->wrflushed, pb->wrbytes - pb->wrflushed, SYNC_FILE_RANGE_WRITE);
+      if(pb->wrflushed > pb->wrdropped)
+      {
+         sync_file_range(pb->fdwrite, pb->wrdropped, pb->wrflushed - pb->wrdropped,
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+         posix_fadvise(pb->fdwrite, pb->wrdropped, pb->wrflushed - pb->wrdropped, POSIX_FADV_DONTNEED);
+         pb->wrdropped = pb->wrflushed;
+      }
+#else
+      fdatasync(pb->fdwrite);
+      posix_fadvise(pb->fdwrite, pb->wrdropped, pb->wrbytes - pb->wrdropped, POSIX_FADV_DONTNEED);
+      pb->wrdropped = pb->wrbytes;
+#endif
+      pb->wrflushed = pb->wrbytes;
+   }
+#endif
+}
+
 int pbread(struct packetbuffer *pb)
 {
+   char *p = pb->endp;
    ssize_t tmp;
+   double t;
+   int held;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+   if(pb->dropcache && pb->rdbytes == 0)
+      posix_fadvise(pb->fdread, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
-   /* read chunks of READSIZE to fill up buffer */
-   while(pb->buffer + BUFFERSIZE - pb->endp >= READSIZE && pb->end == 0){
-      tmp = read(pb->fdread, pb->endp, READSIZE);
-      if(tmp < 1)
+   /* the read slot is only held while reading, see iosched.h */
+   held = pb->dev != NULL && pb->end == 0;
+   if(held)
+      iodev_acquire(pb->dev, pb, iomap_physical(pb->map, pb->rdbytes));
+
+   /* read chunks of iosize to fill up buffer */
+   while(pb->buffer + pb->size - pb->endp >= (ptrdiff_t)pb->iosize && pb->end == 0){
+      throttle_wait(&rdthrottle, pb->iosize);
+      t = stats_now();
+      tmp = read(pb->fdread, pb->endp, pb->iosize);
+      stats_latency(LAT_SYSREAD, t);
+      throttle_latency(&rdthrottle, stats_now() - t);
+      if(tmp == -1 && errno == EINTR)
+         continue;
+      if(tmp == -1)
+      {
+         pb->error = errno;
+         trace(TRC_ERROR, "Cannot read input: %s", strerror(errno));
+         pb->end = 1;
+         break;
+      }
+      if(tmp == 0)
          pb->end = 1;
 
       pb->endp += tmp;
    }
 
+   if(pb->endp > p)
+   {
+      PROBE2(chunk__read, pb->rdbytes, pb->endp - p);
+      pb->rdbytes += pb->endp - p;
+      stats.bytes_read += pb->endp - p;
+   }
+
+   if(held)
+      iodev_release(pb->dev, pb, pb->endp - p, pb->end);
+
+   trring(TR_READ, pb->endp - pb->workp, 0);
+
+   if(pb->dropcache)
+      pbdropcache(pb, 0);
+
+   return pb->error != 0;
+}
+
+/*
+ * write() up to len bytes from startp and move startp past them. A
+ * failure is kept in pb->error, a write of nothing counts as ENOSPC.
+ */
+static int pbwritechunk(struct packetbuffer *pb, size_t len)
+{
+   ssize_t n;
+   double t;
+
+   throttle_wait(&wrthrottle, len);
+   do
+   {
+      t = stats_now();
+      n = write(pb->fdwrite, pb->startp, len);
+      stats_latency(LAT_SYSWRITE, t);
+   } while(n == -1 && errno == EINTR);
+
+   if(n == -1 || n == 0)
+   {
+      pb->error = (n == 0) ? ENOSPC : errno;
+      trace(TRC_ERROR, "Cannot write output: %s", strerror(pb->error));
+      return 1;
+   }
+
+   pb->startp += n;
+
    return 0;
 }
 
-int pbwrite(struct packetbuffer *pb)
+/*
+ * Write out whole chunks of decrypted data, with all set also the
+ * last partial one. Returns 1 once a write failed.
+ */
+static int pbwritebuf(struct packetbuffer *pb, int all)
 {
-   /* write chunks of WRITESIZE */
-   while(pb->workp - pb->startp >= WRITESIZE)
-      pb->startp += write(pb->fdwrite, pb->startp, WRITESIZE);
+   char *p = pb->startp;
+
+   /* write chunks of iosize */
+   while(pb->workp - pb->startp >= (ptrdiff_t)pb->iosize && pb->error == 0)
+      pbwritechunk(pb, pb->iosize);
 
    /* write remaining bytes at end of file */
-   while(pb->workp - pb->startp > 0 && pb->end == 1)
-      pb->startp += write(pb->fdwrite, pb->startp, pb->workp - pb->startp);
+   while(pb->workp - pb->startp > 0 && all && pb->error == 0)
+      pbwritechunk(pb, pb->workp - pb->startp);
+
+   if(pb->startp > p)
+   {
+      PROBE2(chunk__written, pb->wrbytes, pb->startp - p);
+      trring(TR_WRITE, pb->startp - p, 0);
+      pb->wrbytes += pb->startp - p;
+      stats.bytes_written += pb->startp - p;
+      if(pb->hash != NULL)
+         jhash_update(pb->hash, p, pb->startp - p);
+   }
 
-   /* copy over remaining bytes */
+   if(pb->dropcache)
+      pbdropcache(pb, pb->end);
+
+   /* copy over remaining bytes, source and destination may overlap */
    if(pb->endp - pb->startp > 0)
-      memcpy(pb->buffer, pb->startp, pb->endp - pb->startp);
+      memmove(pb->buffer, pb->startp, pb->endp - pb->startp);
 
    pb->endp = pb->buffer + (pb->endp - pb->startp);
    pb->workp = pb->buffer + (pb->workp - pb->startp);
    pb->startp = pb->buffer;
 
-   return 0;
+   return pb->error != 0;
+}
+
+int pbwrite(struct packetbuffer *pb)
+{
+   return pbwritebuf(pb, pb->end == 1);
+}
+
+/*
+ * Write everything decrypted so far, so the output ends on a packet
+ * boundary, e.g. for a journal checkpoint.
+ */
+int pbflush(struct packetbuffer *pb)
+{
+   return pbwritebuf(pb, 1);
 }
 
+/*
+ * Remove the bytes between p and workp, e.g. packets that were
+ * filtered out, by moving the rest of the buffer down.
+ */
+void pbcut(struct packetbuffer *pb, char *p)
+{
+   if(p >= pb->workp)
+      return;
+
+   memmove(p, pb->workp, pb->endp - pb->workp);
+   pb->endp -= pb->workp - p;
+   pb->workp = p;
+}
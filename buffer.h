@@ -10,26 +10,69 @@
 #ifndef _BUFFER_H_
 #define _BUFFER_H_
 
+#include <stddef.h>
+
 #define READSIZE    4096
 #define WRITESIZE   4096
 #define PACKETSIZE  188
 #define BUFFERSIZE  (READSIZE+READSIZE+PACKETSIZE)
 
+#ifdef LOWMEM
+#define DEFAULT_IOSIZE  (16*1024)
+#else
+#define DEFAULT_IOSIZE  READSIZE
+#endif
+
+/* drop consumed pages from the page cache every DROPCACHE_CHUNK bytes */
+#define DROPCACHE_CHUNK (1024*1024)
+
+/* default distance in packets for prefetching in the decode loop */
+#define PREFETCH_PACKETS  4
+
+/* prefetch for writing, packets are decrypted in place */
+#ifdef _MSC_VER
+#define pbprefetch(p)  _mm_prefetch((const char *)(p), _MM_HINT_T0)
+#else
+#define pbprefetch(p)  __builtin_prefetch((p), 1, 3)
+#endif
+
+/* buffer size for a given read/write size, see pbinit() */
+#define PBSIZE(io)  (2*(io)+PACKETSIZE)
+#define PBALIGN     4096
+
 struct packetbuffer
 {
    char *buffer;
+   size_t size;
+   size_t iosize;
    char *startp;
    char *workp;
    char *endp;
    int end;
    int fdread;
    int fdwrite;
+   unsigned long long rdbytes;
+   unsigned long long wrbytes;
+   int dropcache;
+   unsigned long long rddropped;
+   unsigned long long wrflushed;
+   unsigned long long wrdropped;
+   struct iodev *dev;         /* read slot of the input device, see iosched.h */
+   struct iomap *map;         /* extents of the input, NULL if unknown */
+   size_t reserved;           /* bytes of the buffer budget held */
+   struct jhash *hash;        /* hash of the output, NULL if not needed */
+   int error;                 /* errno of a failed read or write, 0 if none */
 };
 
-extern int pbinit(struct packetbuffer *pb);
+/* input file offset of a pointer into the buffer */
+#define pboffset(pb, p)  ((pb)->rdbytes - (unsigned long long)((pb)->endp - (p)))
+
+extern int pbinit(struct packetbuffer *pb, size_t iosize);
 extern int pbfree(struct packetbuffer *pb);
 extern int pbread(struct packetbuffer *pb);
 extern int pbwrite(struct packetbuffer *pb);
+extern int pbflush(struct packetbuffer *pb);
+extern void pbcut(struct packetbuffer *pb, char *p);
 
 #endif /* _BUFFER_H_ */
 
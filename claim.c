@@ -0,0 +1,339 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _MSC_VER
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "claim.h"
+#include "thread.h"
+#include "trace.h"
+
+/*
+ * Claims held by this process. They live across arena resets of the
+ * workers, so they come from the plain heap; LOWMEM has one worker and
+ * one static claim.
+ */
+struct claim
+{
+   char file[PATH_MAX];       /* recording as given */
+   char path[PATH_MAX];       /* claim file */
+   int fd;
+   unsigned long long *lost;  /* set once taken over */
+   struct claim *next;
+};
+
+static char claimdir[PATH_MAX];
+static int claimlease = CLAIM_LEASE;
+static char owner[300];
+static char ownerid[300];     /* host.pid, unique between contenders */
+static struct claim *claims = NULL;
+static pthread_mutex_t claim_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef LOWMEM
+static struct claim claim_one;
+#endif
+
+/*
+ * Claims are named <key>-<name>.<suffix>, so recordings of the same
+ * name in different directories do not share one. The key is the
+ * inode number rather than the path, since the machines sharing the
+ * claim directory may mount the recordings in different places while
+ * NFS and SMB report the inode number of the server. A file that
+ * cannot be stat'ed falls back to a hash of its path.
+ */
+static void claim_path(char *path, const char *file, const char *suffix)
+{
+   char tmp[PATH_MAX];
+   unsigned long long key = 14695981039346656037ULL;
+   struct stat st;
+   const char *p;
+
+   if(stat(file, &st) == 0)
+      key = (unsigned long long)st.st_ino;
+   else
+   {
+      for(p = file; *p; p++)
+         key = (key ^ (unsigned char)*p) * 1099511628211ULL;
+   }
+
+   snprintf(tmp, sizeof(tmp), "%s", file);
+   if(snprintf(path, PATH_MAX, "%s/%llx-%s.%s", claimdir, key, basename(tmp), suffix) >= PATH_MAX)
+      trace(TRC_WARN, "claim path for %s truncated", file);
+}
+
+/*
+ * Keep our claims fresh. A claim that was taken over while we were
+ * stalled no longer is the file we created, its job is told to stop.
+ */
+static void *claim_renew(void *arg)
+{
+   struct claim *c;
+   struct stat mine, cur;
+
+   (void)arg;
+
+   for(;;)
+   {
+      sleep(claimlease / 3 > 0 ? claimlease / 3 : 1);
+
+      pthread_mutex_lock(&claim_lock);
+      for(c = claims; c != NULL; c = c->next)
+      {
+         if(ATOMIC_LOAD(c->lost))
+            continue;
+
+         if(fstat(c->fd, &mine) != 0 || stat(c->path, &cur) != 0 ||
+            mine.st_ino != cur.st_ino || mine.st_dev != cur.st_dev)
+         {
+            trace(TRC_WARN, "lost claim on %s, stopping", c->file);
+            ATOMIC_STORE(c->lost, 1ULL);
+            continue;
+         }
+
+         if(futimens(c->fd, NULL) != 0)
+            trace(TRC_WARN, "cannot renew claim %s", c->path);
+      }
+      pthread_mutex_unlock(&claim_lock);
+   }
+
+   return NULL;
+}
+
+int claim_init(const char *dir, int lease)
+{
+   char host[256];
+   pthread_t tid;
+   struct stat st;
+
+   if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))
+   {
+      trace(TRC_ERROR, "claim directory %s does not exist", dir);
+      return 1;
+   }
+
+   snprintf(claimdir, sizeof(claimdir), "%s", dir);
+   if(lease > 0)
+      claimlease = lease;
+
+   if(gethostname(host, sizeof(host)) != 0)
+      strcpy(host, "unknown");
+   host[sizeof(host)-1] = '\0';
+   snprintf(owner, sizeof(owner), "%s %ld\n", host, (long)getpid());
+   snprintf(ownerid, sizeof(ownerid), "%s.%ld", host, (long)getpid());
+
+   if(pthread_create(&tid, NULL, claim_renew, NULL) != 0)
+   {
+      trace(TRC_ERROR, "cannot start claim renewal");
+      return 1;
+   }
+   pthread_detach(tid);
+
+   return 0;
+}
+
+/*
+ * Replace an expired claim by a new one of ours. The new claim is made
+ * under a name of our own first; its mtime is the time of the file
+ * server, which the age of the old claim is measured against so the
+ * clocks of the machines do not matter. It then replaces the old claim
+ * in one rename(), so the claim name never is free for someone else
+ * to create. Contenders that judged the same claim stale all rename,
+ * the last one wins and the others see that when checking afterwards,
+ * or at their next renewal.
+ *
+ * Returns the descriptor of the new claim, -1 if the claim is held by
+ * someone else and -2 if it is gone and can be created again.
+ */
+static int claim_takeover(const char *path)
+{
+   char mine[PATH_MAX+300];
+   struct stat st, now, cur;
+   int fd;
+
+   snprintf(mine, sizeof(mine), "%s.%s", path, ownerid);
+   unlink(mine);
+   if((fd = open(mine, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1)
+   {
+      trace(TRC_WARN, "cannot create %s: %s", mine, strerror(errno));
+      return -1;
+   }
+
+   if(stat(path, &st) != 0)
+   {
+      close(fd);
+      unlink(mine);
+      return errno == ENOENT ? -2 : -1;
+   }
+
+   if(fstat(fd, &now) != 0 || now.st_mtime - st.st_mtime <= claimlease ||
+      rename(mine, path) != 0)
+   {
+      close(fd);
+      unlink(mine);
+      return -1;
+   }
+
+   if(stat(path, &cur) != 0 || cur.st_ino != now.st_ino || cur.st_dev != now.st_dev)
+   {
+      trace(TRC_INFO, "expired claim %s was taken over by someone else", path);
+      close(fd);
+      return -1;
+   }
+
+   trace(TRC_INFO, "took over expired claim %s", path);
+
+   return fd;
+}
+
+/*
+ * Returns 0 if file is ours to decrypt, 1 if it is done or claimed by
+ * someone else. *lost is set when the claim is lost later on.
+ */
+int claim_acquire(const char *file, unsigned long long *lost)
+{
+   char path[PATH_MAX];
+   struct claim *c;
+   int fd, tries;
+
+   claim_path(path, file, "done");
+   if(access(path, F_OK) == 0)
+   {
+      trace(TRC_INFO, "%s already done", file);
+      return 1;
+   }
+
+   claim_path(path, file, "claim");
+   for(tries = 0; tries < 2; tries++)
+   {
+      fd = open(path, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+      if(fd != -1 || errno != EEXIST || (fd = claim_takeover(path)) != -2)
+         break;
+   }
+
+   if(fd < 0)
+   {
+      trace(TRC_INFO, "%s claimed by another process", file);
+      return 1;
+   }
+
+   if(write(fd, owner, strlen(owner)) < 0)
+      trace(TRC_WARN, "cannot write claim %s", path);
+
+#ifdef LOWMEM
+   c = (claims == NULL) ? &claim_one : NULL;
+#else
+   c = calloc(1, sizeof(*c));
+#endif
+   if(c == NULL)
+   {
+      close(fd);
+      unlink(path);
+      return 1;
+   }
+
+   snprintf(c->file, sizeof(c->file), "%s", file);
+   snprintf(c->path, sizeof(c->path), "%s", path);
+   c->fd = fd;
+   c->lost = lost;
+   ATOMIC_STORE(lost, 0ULL);
+
+   pthread_mutex_lock(&claim_lock);
+   c->next = claims;
+   claims = c;
+   pthread_mutex_unlock(&claim_lock);
+
+   return 0;
+}
+
+/*
+ * Mark file done unless it failed and give up the claim. A failed
+ * file can be claimed again. A claim taken over by someone else is
+ * neither marked nor removed, it belongs to the new owner.
+ */
+void claim_release(const char *file, int failed)
+{
+   struct claim **p, *c = NULL;
+   struct stat mine, cur;
+   char path[PATH_MAX];
+   int fd, ours;
+
+   pthread_mutex_lock(&claim_lock);
+   for(p = &claims; *p != NULL; p = &(*p)->next)
+   {
+      if(strcmp((*p)->file, file) == 0)
+      {
+         c = *p;
+         *p = c->next;
+         break;
+      }
+   }
+   pthread_mutex_unlock(&claim_lock);
+
+   if(c == NULL)
+      return;
+
+   ours = !ATOMIC_LOAD(c->lost) && fstat(c->fd, &mine) == 0 &&
+      stat(c->path, &cur) == 0 && mine.st_ino == cur.st_ino && mine.st_dev == cur.st_dev;
+   if(!ours)
+      trace(TRC_WARN, "claim on %s was taken over, left to its new owner", file);
+
+   if(ours && !failed)
+   {
+      claim_path(path, file, "done");
+      if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) != -1)
+      {
+         if(write(fd, owner, strlen(owner)) < 0)
+            trace(TRC_WARN, "cannot write %s", path);
+         close(fd);
+      }
+      else
+         trace(TRC_ERROR, "cannot create %s", path);
+   }
+
+   if(ours)
+      unlink(c->path);
+
+   close(c->fd);
+#ifndef LOWMEM
+   free(c);
+#endif
+}
+
+#else
+
+#include "claim.h"
+#include "trace.h"
+
+int claim_init(const char *dir, int lease)
+{
+   trace(TRC_ERROR, "--claim-dir is not supported on this platform");
+   return 1;
+}
+
+int claim_acquire(const char *file, unsigned long long *lost)
+{
+   return 0;
+}
+
+void claim_release(const char *file, int failed)
+{
+}
+
+#endif
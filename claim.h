@@ -0,0 +1,33 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _CLAIM_H_
+#define _CLAIM_H_
+
+#define CLAIM_LEASE  60   /* default seconds before a claim can be taken over */
+
+/*
+ * Job claiming through a directory shared by several processes or
+ * machines (NFS, SMB). A recording is claimed by creating
+ * <claimdir>/<inode>-<name>.claim with O_EXCL, which is atomic on NFSv3
+ * and later. While the file is decrypted a helper thread touches the claim
+ * every third of the lease. A claim older than the lease, by the clock
+ * of the file server, belongs to a dead process and is replaced by a
+ * new claim with rename(). Finished recordings get a <inode>-<name>.done
+ * marker and are skipped by everyone.
+ *
+ * A process stalled for longer than the lease may find its claim taken
+ * over. The renewal then sets *lost of claim_acquire(), the job has to
+ * stop, and claim_release() leaves the file to the new owner.
+ */
+extern int claim_init(const char *dir, int lease);
+extern int claim_acquire(const char *file, unsigned long long *lost);
+extern void claim_release(const char *file, int failed);
+
+#endif /* _CLAIM_H_ */
@@ -0,0 +1,925 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#ifdef _MSC_VER
+#include "w32\w32.h"
+#else
+#include <libgen.h>
+#include <unistd.h>
+#include <cpuid.h>
+#endif
+
+
+#include "aes.h"
+#include "decrypt.h"
+#include "trace.h"
+#include "tracering.h"
+#include "probes.h"
+#include "buffer.h"
+#include "stats.h"
+#include "progress.h"
+#include "perfcnt.h"
+#include "mem.h"
+#include "arena.h"
+#include "iosched.h"
+#include "journal.h"
+#include "thread.h"
+
+#ifndef O_BINARY
+#define O_BINARY  0
+#endif
+
+THREAD_LOCAL block_state state;
+THREAD_LOCAL struct perfcnt perfcnt;
+int enable_aesni = 0;
+char *metricsfile = NULL;
+int enable_perfcnt = 0;
+size_t iosize = DEFAULT_IOSIZE;
+int prefetch = PREFETCH_PACKETS;
+#ifdef LOWMEM
+int dropcache = 1;
+#else
+int dropcache = 0;
+#endif
+int arenaflags = 0;
+
+
+/*
+ * Check for AES-NI CPU support
+ */
+int Check_CPU_support_AES(void)
+{
+#if defined(__INTEL_COMPILER)
+   int CPUInfo[4] = {-1};
+   __cpuid(CPUInfo, 1);
+   return (CPUInfo[2] & 0x2000000);
+#else
+   unsigned int a=1,b,c,d;
+   __cpuid(1, a,b,c,d);
+   return (c & 0x2000000);
+#endif
+}
+
+
+char *filename(char *path, const char *newsuffix)
+{
+   char *end = path + strlen(path);
+
+   while(*end != '.' && *end != '/')
+      --end;
+
+   if(newsuffix != NULL)
+      strcpy(++end, newsuffix);
+   else
+      *end = '\0';
+
+   return path;
+}
+
+/*
+ * Key schedule for a DRM key, from the .mdb file or given directly
+ */
+void setdrmkey(const unsigned char *drmkey, const char *source)
+{
+   char tmpbuf[64];
+   unsigned int j;
+
+   memset(tmpbuf, '\0', sizeof(tmpbuf));
+   memset(&state, 0, sizeof(block_state));
+   state.rounds = 10;
+
+   for (j = 0; j < 0x10; j++)
+      sprintf(tmpbuf+strlen(tmpbuf), "%02X ", drmkey[j]);
+
+   trace(TRC_INFO, "KEY: %s", tmpbuf);
+
+   if(enable_aesni)
+      block_init_aesni(&state, (unsigned char *)drmkey, BLOCK_SIZE);
+   else
+      block_init_aes(&state, (unsigned char *)drmkey, BLOCK_SIZE);
+
+   PROBE2(key__loaded, source, enable_aesni);
+}
+
+/*
+ * Read the DRM key from mdbfile. -1 if it cannot be opened, 1 if it
+ * is too short.
+ */
+static int mdbkey(const char *mdbfile, unsigned char *drmkey)
+{
+   unsigned char raw[0x10];
+   unsigned int j;
+   int mdbfd;
+
+   if((mdbfd = open(mdbfile, O_RDONLY | O_BINARY)) == -1)
+      return -1;
+
+   if(lseek(mdbfd, 8, SEEK_SET) != 8 || read(mdbfd, raw, sizeof(raw)) != (int)sizeof(raw)){
+      close(mdbfd);
+      return 1;
+   }
+   close(mdbfd);
+
+   /* key is stored as four byte swapped words */
+   for (j = 0; j < 0x10; j++)
+      drmkey[(j&0xc)+(3-(j&3))] = raw[j];
+
+   return 0;
+}
+
+int readdrmkey(char *mdbfile)
+{
+   unsigned char drmkey[0x10];
+   int ret;
+
+   if((ret = mdbkey(mdbfile, drmkey)) == 0)
+   {
+      trace(TRC_INFO, "drm key successfully read from %s", basename(mdbfile));
+      setdrmkey(drmkey, mdbfile);
+
+      return 0;
+   }
+   else if(ret > 0)
+      trace(TRC_ERROR, "short read while reading DRM key");
+   else
+      trace(TRC_ERROR, "mdb file %s not found", basename(mdbfile));
+
+   return 1;
+}
+
+void freedrmkey(void)
+{
+   if(enable_aesni)
+      block_finalize_aesni(&state);
+   else
+      block_finalize_aes(&state);
+}
+
+int genoutfilename(char *outfile, char *inffile)
+{
+   unsigned char inf[0x200];
+   char tmpname[PATH_MAX];
+   int i, inffd;
+
+   if((inffd = open(inffile, O_RDONLY | O_BINARY)) != -1)
+   {
+      if(read(inffd, inf, sizeof(inf)) != (int)sizeof(inf)){
+         trace(TRC_ERROR, "short read while reading inf file");
+         close(inffd);
+         return 1;
+      }
+      close(inffd);
+
+      /* build base path */
+      strcpy(tmpname, basename(inffile));
+      filename(tmpname, NULL);
+      strcat(tmpname, "-");
+      
+      /* http://code.google.com/p/samy-pvr-manager/wiki/InfFileStructure */
+
+      /* copy channel name and program title */
+      for(i=1; i < 0x200; i += 2)
+      {
+         if (inf[i])
+         {
+            if((inf[i] >= 'A' && inf[i] <= 'z') || (inf[i] >= '0' && inf[i] <= '9'))
+               strncat(tmpname, (char*)&inf[i], 1);
+            else
+               strcat(tmpname, "_");
+         }
+         if (i == 0xFF) {
+            strcat(tmpname, "_-_");
+         }
+      }
+
+      strcat(tmpname, ".ts");
+
+      strcat(outfile, tmpname);
+   }
+   else
+      return 1;
+
+   return 0;
+}
+
+/*
+ * .mdb and .inf of srffile, as given or derived from its name for
+ * recordings that were not paired up by the walk
+ */
+static void decrypt_names(const char *srffile, const char *mdbin, const char *infin,
+   char *mdbfile, char *inffile)
+{
+   if(mdbin != NULL)
+      snprintf(mdbfile, PATH_MAX, "%s", mdbin);
+   else
+      filename(strcpy(mdbfile, srffile), "mdb");
+
+   if(infin != NULL)
+      snprintf(inffile, PATH_MAX, "%s", infin);
+   else
+      filename(strcpy(inffile, srffile), "inf");
+}
+
+/*
+ * Read the key and output name of srffile ahead of its job, and have
+ * the kernel start reading the first chunk. Failures are left for the
+ * job to find and report.
+ */
+void decrypt_readmeta(struct decrypt_meta *meta, const char *srffile,
+   const char *mdbfile, const char *inffile)
+{
+   char mdbpath[PATH_MAX];
+   char infpath[PATH_MAX];
+#ifdef POSIX_FADV_WILLNEED
+   int fd;
+#endif
+
+   meta->valid = 0;
+   meta->outname[0] = '\0';
+
+   if(strlen(srffile) >= PATH_MAX)
+      return;
+
+   decrypt_names(srffile, mdbfile, inffile, mdbpath, infpath);
+
+   if(mdbkey(mdbpath, meta->key) != 0)
+      return;
+
+   if(infpath[0] != '\0')
+      genoutfilename(meta->outname, infpath);
+
+#ifdef POSIX_FADV_WILLNEED
+   if((fd = open(srffile, O_RDONLY | O_BINARY)) != -1)
+   {
+      posix_fadvise(fd, 0, iosize, POSIX_FADV_WILLNEED);
+      close(fd);
+   }
+#endif
+
+   meta->valid = 1;
+}
+
+
+int decrypt_aes128cbc(unsigned char *pin, int len, unsigned char *pout)
+{
+   int i;
+
+   if(len % BLOCK_SIZE != 0)
+   {
+      trace(TRC_ERROR, "Decrypt length needs to be a multiple of BLOCK_SIZE");
+      return 1;
+   }
+
+   if(enable_aesni)
+   {
+      block_decrypt_aesni_n(&state, pin, pout, len / BLOCK_SIZE);
+      return 0;
+   }
+
+   for(i=0; i < len; i+=BLOCK_SIZE)
+      block_decrypt_aes(&state, pin + i, pout + i);
+
+   return 0;
+}
+
+
+/*
+ * Decode a MPEG packet
+ *
+ * Transport Stream Header:
+ * ========================
+ *
+ * Name                    | bits | byte msk | Description
+ * ------------------------+------+----------+-----------------------------------------------
+ * sync byte               | 8    | 0xff     | Bit pattern from bit 7 to 0 as 0x47
+ * Transp. Error Indicator | 1    | 0x80     | Set when a demodulator cannot correct errors from FEC data
+ * Payload Unit start ind. | 1    | 0x40     | Boolean flag with a value of true means the start of PES
+ *                         |      |          | data or PSI otherwise zero only.
+ * Transport Priority      | 1    | 0x20     | Boolean flag with a value of true means the current packet
+ *                         |      |          | has a higher priority than other packets with the same PID.
+ * PID                     | 13   | 0x1fff   | Packet identifier
+ * Scrambling control      | 2    | 0xc0     | 00 = not scrambled
+ *                         |      |          | 01 = Reserved for future use (DVB-CSA only)
+ *                         |      |          | 10 = Scrambled with even key (DVB-CSA only)
+ *                         |      |          | 11 = Scrambled with odd key (DVB-CSA only)
+ * Adaptation field exist  | 1    | 0x20     | Boolean flag
+ * Contains payload        | 1    | 0x10     | Boolean flag
+ * Continuity counter      | 4    | 0x0f     | Sequence number of payload packets (0x00 to 0x0F)
+ *                         |      |          | Incremented only when a playload is present
+ *
+ * Adaptation Field:
+ * ========================
+ *
+ * Name                    | bits | byte msk | Description
+ * ------------------------+------+----------+-----------------------------------------------
+ * Adaptation Field Length | 8    | 0xff     | Number of bytes immediately following this byte
+ * Discontinuity indicator | 1    | 0x80     | Set to 1 if current TS packet is in a discontinuity state
+ * Random Access indicator | 1    | 0x40     | Set to 1 if PES packet starts a video/audio sequence
+ * Elementary stream prio  | 1    | 0x20     | 1 = higher priority
+ * PCR flag                | 1    | 0x10     | Set to 1 if adaptation field contains a PCR field
+ * OPCR flag               | 1    | 0x08     | Set to 1 if adaptation field contains a OPCR field
+ * Splicing point flag     | 1    | 0x04     | Set to 1 if adaptation field contains a splice countdown field
+ * Transport private data  | 1    | 0x02     | Set to 1 if adaptation field contains private data bytes
+ * Adapt. field extension  | 1    | 0x01     | Set to 1 if adaptation field contains extension
+ * Below fields optional   |      |          | Depends on flags
+ * PCR                     | 33+6+9 |        | Program clock reference
+ * OPCR                    | 33+6+9 |        | Original Program clock reference
+ * Splice countdown        | 8    | 0xff     | Indicates how many TS packets from this one a splicing point
+ *                         |      |          | occurs (may be negative)
+ * Stuffing bytes          | 0+   |          |
+ *
+ *
+ * See: http://en.wikipedia.org/wiki/MPEG_transport_stream
+ */
+int decode_packet(unsigned char *data)
+{
+   int offset;
+
+   if(data[0] != 0x47)
+   {
+      trace(TRC_ERROR, "Not a valid MPEG packet!");
+      return 1;
+   }
+
+   trace(TRC_DEBUG, "-------------------");
+   trace(TRC_DEBUG, "Trans. Error Indicator: 0x%x", data[2] & 0x80);
+   trace(TRC_DEBUG, "Payload Unit start Ind: 0x%x", data[2] & 0x40);
+   trace(TRC_DEBUG, "Transport Priority    : 0x%x", data[2] & 0x20);
+   trace(TRC_DEBUG, "Scrambling control    : 0x%x", data[3] & 0xC0);
+   trace(TRC_DEBUG, "Adaptation field exist: 0x%x", data[3] & 0x20);
+   trace(TRC_DEBUG, "Contains payload      : 0x%x", data[3] & 0x10);
+   trace(TRC_DEBUG, "Continuity counter    : 0x%x", data[3] & 0x0f);
+
+   trring(TR_PACKET, (data[1] << 16) | (data[2] << 8) | data[3], data[3] & 0x20 ? data[4]+5 : 4);
+
+   /* only process scrambled content */
+   if(((data[3] & 0xC0) != 0xC0) && ((data[3] & 0xC0) != 0x80))
+     return 1;
+
+   if(data[3] & 0x20)
+	   trace(TRC_DEBUG, "Adaptation Field length: 0x%x", data[4]+1);
+
+   offset=4;
+
+   /* skip adaption field */
+   if(data[3] & 0x20)
+      offset += (data[4]+1);
+
+   /* remove scrambling bits */
+   data[3] &= 0x3f;
+
+   /* decrypt only full blocks (they seem to avoid padding), in place */
+   decrypt_aes128cbc(data + offset, ((PACKETSIZE - offset)/BLOCK_SIZE)*BLOCK_SIZE, data + offset);
+
+   stats.packets++;
+
+   return 0;
+}
+
+/*
+ * Packet filter state of a file. The time is taken from the last PCR,
+ * of any PID, relative to the first one.
+ */
+struct tsfstate
+{
+   const struct tsfilter *f;
+   long long pcr0;               /* -1 before the first PCR */
+   double now;
+};
+
+static void tsfilter_init(struct tsfstate *tf, const struct tsfilter *f)
+{
+   tf->f = f;
+   tf->pcr0 = -1;
+   tf->now = 0;
+}
+
+static int tsfilter_keep(struct tsfstate *tf, const unsigned char *data)
+{
+   const struct tsfilter *f = tf->f;
+   unsigned int pid = ((data[1] & 0x1f) << 8) | data[2];
+   long long pcr;
+   int i;
+
+   /* the PCR is in the adaptation field, which is never scrambled */
+   if((data[3] & 0x20) && data[4] >= 7 && (data[5] & 0x10))
+   {
+      pcr = ((long long)data[6] << 25) | (data[7] << 17) | (data[8] << 9) |
+            (data[9] << 1) | (data[10] >> 7);
+      if(tf->pcr0 < 0)
+         tf->pcr0 = pcr;
+      if(pcr < tf->pcr0)
+         pcr += 1LL << 33;
+      tf->now = (pcr - tf->pcr0) / 90000.0;
+   }
+
+   if(tf->now < f->start || (f->end > 0 && tf->now >= f->end))
+      return 0;
+
+   if(f->npids == 0 || pid == 0)
+      return 1;
+
+   for(i=0; i < f->npids; i++)
+   {
+      if(f->pids[i] == pid)
+         return 1;
+   }
+
+   return 0;
+}
+
+/*
+ * Continue a job at its checkpoint. The output is cut back to the
+ * checkpoint and the hash state completed with the bytes of the last
+ * partial word, which are read back from the output.
+ */
+static int decrypt_resume(struct decrypt_job *job, struct packetbuffer *pb,
+   struct jhash *jh, unsigned long long filesize)
+{
+   unsigned long long off = job->offset;
+   unsigned long long base = off & ~7ULL;
+   unsigned char tail[8];
+
+   if(off > filesize || lseek(pb->fdwrite, 0, SEEK_END) < (off_t)off)
+      return 1;
+
+   if(lseek(pb->fdwrite, base, SEEK_SET) != (off_t)base ||
+      read(pb->fdwrite, tail, off - base) != (int)(off - base))
+      return 1;
+
+   if(ftruncate(pb->fdwrite, off) != 0 ||
+      lseek(pb->fdwrite, off, SEEK_SET) != (off_t)off ||
+      lseek(pb->fdread, off, SEEK_SET) != (off_t)off)
+      return 1;
+
+   jhash_init(jh, job->hash);
+   jhash_update(jh, tail, off - base);
+
+   pb->rdbytes = pb->wrbytes = off;
+   pb->rddropped = pb->wrflushed = pb->wrdropped = off;
+
+   return 0;
+}
+
+/*
+ * Decrypt job->srffile into job->outdir. Progress is published in
+ * job->total and job->done for other threads.
+ */
+static int decryptjob(struct decrypt_job *job)
+{
+   const char *srffile = job->srffile;
+   char mdbfile[PATH_MAX];
+   char inffile[PATH_MAX];
+   char outfile[PATH_MAX];
+   struct packetbuffer pb;
+   struct progress pg;
+   unsigned long long resyncs = 0;
+   unsigned long long packets = stats.packets;
+   struct memstats mem, now;
+   char *chunkp;
+   double t, tchunk;
+   int retries, sync_find = 0, stopped = 0;
+   unsigned long filesize = 0;
+   unsigned long i;
+   size_t pfdist = (size_t)prefetch * PACKETSIZE;
+   unsigned long long checkpoint = 0;
+   struct jhash jh;
+   struct tsfstate tf;
+   char *keepp;
+
+   mem_snapshot(&mem);
+   memset(&pb, '\0', sizeof(pb));
+   memset(inffile, '\0', sizeof(inffile));
+   memset(mdbfile, '\0', sizeof(mdbfile));
+   memset(outfile, '\0', sizeof(outfile));
+
+   decrypt_names(srffile, job->mdbfile, job->inffile, mdbfile, inffile);
+
+   /* read drm key from .mdb file */
+   if(job->key != NULL)
+      setdrmkey(job->key, srffile);
+   else if(job->meta != NULL && job->meta->valid)
+   {
+      trace(TRC_INFO, "drm key successfully read from %s", basename(mdbfile));
+      setdrmkey(job->meta->key, mdbfile);
+   }
+   else if(readdrmkey(mdbfile) != 0)
+      return 1;
+
+   /* generate outfile name based on title from .inf file */
+   if(job->outfile != NULL && *job->outfile != '\0')
+      snprintf(outfile, sizeof(outfile), "%s", job->outfile);
+   else
+   {
+      strcpy(outfile, job->outdir);
+      if(job->meta != NULL && job->meta->outname[0] != '\0')
+         strcat(outfile, job->meta->outname);
+      else if((job->meta != NULL && job->meta->valid) || inffile[0] == '\0' ||
+              genoutfilename(outfile, inffile) != 0)
+      {
+         /* the .inf is not needed anymore, basename() may modify */
+         strcpy(inffile, srffile);
+         strcat(outfile, basename(inffile));
+         filename(outfile, "ts");
+      }
+   }
+
+   trace(TRC_INFO, "Writing to %s", outfile);
+
+   if(pbinit(&pb, job->iosize ? job->iosize : iosize) != 0)
+   {
+      freedrmkey();
+      return 1;
+   }
+   pb.dropcache = dropcache;
+
+#ifdef _MSC_VER
+   int wmode = _S_IWRITE;
+   int binaryflag =  _O_BINARY;
+#else
+   mode_t wmode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+   int binaryflag = 0;
+#endif
+   /* a resumed job reads back the last bytes of its output */
+   pb.fdwrite = open(outfile, job->offset > 0 ? O_RDWR | O_CREAT | binaryflag :
+      O_WRONLY | O_CREAT | O_TRUNC | binaryflag, wmode);
+   if(pb.fdwrite == -1)
+   {
+      trace(TRC_ERROR, "Cannot open %s for writing", outfile);
+      pbfree(&pb);
+      freedrmkey();
+      return 1;
+   }
+
+   pb.fdread = open(srffile, O_RDONLY | binaryflag);
+   if(pb.fdread == -1)
+   {
+      trace(TRC_ERROR, "Cannot open %s for reading", srffile);
+      close(pb.fdwrite);
+      pbfree(&pb);
+      freedrmkey();
+      return 1;
+   }
+   pb.dev = iosched_device(pb.fdread);
+   if(iosched_elevator && pb.dev != NULL && pb.dev->rotational)
+      pb.map = iosched_map(pb.fdread);
+	
+
+   /* calculate filesize */
+   filesize = lseek(pb.fdread, 0, SEEK_END);
+   lseek(pb.fdread, 0, SEEK_SET);
+
+   trace(TRC_INFO, "Filesize %ld", filesize);
+
+   tsfilter_init(&tf, job->filter);
+   if(job->filter != NULL)
+      job->offset = 0;
+
+   if(job->journal)
+   {
+      jhash_init(&jh, JHASH_BASIS);
+
+      if(job->offset > 0 && decrypt_resume(job, &pb, &jh, filesize) != 0)
+      {
+         trace(TRC_WARN, "Cannot resume %s at %llu, starting over", srffile, job->offset);
+         job->offset = 0;
+         jhash_init(&jh, JHASH_BASIS);
+         if(ftruncate(pb.fdwrite, 0) != 0 || lseek(pb.fdwrite, 0, SEEK_SET) != 0 ||
+            lseek(pb.fdread, 0, SEEK_SET) != 0)
+         {
+            trace(TRC_ERROR, "Cannot rewind %s", outfile);
+            close(pb.fdwrite);
+            close(pb.fdread);
+            pbfree(&pb);
+            freedrmkey();
+            return 1;
+         }
+      }
+      else if(job->offset > 0)
+         trace(TRC_INFO, "Resuming %s at offset %llu", srffile, job->offset);
+
+      pb.hash = &jh;
+      checkpoint = job->offset;
+      journal_record(JR_RUNNING, srffile, job->outdir, job->priority, job->offset, jh.h);
+   }
+   trring(TR_FILE_OPEN, filesize, 0);
+   PROBE2(file__open, srffile, filesize);
+   progress_begin(&pg, srffile, filesize);
+   ATOMIC_STORE(&job->total, (unsigned long long)filesize);
+
+   if(enable_perfcnt)
+      perfcnt_reset(&perfcnt);
+
+resync:
+
+   /* try to sync */
+   sync_find = 0;
+   retries = 10;
+
+   while(sync_find == 0 && retries-- > 0)
+   {
+      trring(TR_RESYNC, retries, 0);
+      t = stats_now();
+      pbread(&pb);
+      stats_latency(LAT_READ, t);
+
+      /* a checkpoint is at a packet boundary in sync */
+      if(job->offset > 0 && pboffset(&pb, pb.workp) == job->offset && *pb.workp == 0x47)
+      {
+         sync_find = 1;
+         trace(TRC_INFO, "synced at checkpoint %llu", job->offset);
+         break;
+      }
+
+      /* search packets starting with 0x47 */
+      for(i=0; pb.workp+i+PACKETSIZE+PACKETSIZE < pb.endp; i++)
+      {
+         if (*(pb.workp+i) == 0x47 && *(pb.workp+i+PACKETSIZE) == 0x47 && *(pb.workp+i+PACKETSIZE+PACKETSIZE) == 0x47)
+         {
+            sync_find = 1;
+            pb.workp += i;
+
+            trace(TRC_INFO, "synced at offset %ld", pb.workp-pb.startp);
+            trring(TR_SYNC, pb.workp-pb.startp, 0);
+            PROBE1(sync__found, pboffset(&pb, pb.workp));
+
+            break;
+         }
+      }
+   }
+
+   if (sync_find)
+   {
+      while(pb.end == 0 && pb.error == 0)
+      {
+         t = tchunk = stats_now();
+         pbread(&pb);
+         stats_latency(LAT_READ, t);
+
+         t = stats_now();
+         chunkp = keepp = pb.workp;
+
+         if(enable_perfcnt)
+            perfcnt_start(&perfcnt);
+
+         while(pb.workp+PACKETSIZE <= pb.endp)
+         {
+            /* pull the packet prefetch packets ahead into L1, all of
+               its cache lines since the payload offset varies */
+            if(prefetch > 0 && pb.workp + pfdist + PACKETSIZE <= pb.endp)
+            {
+               pbprefetch(pb.workp + pfdist);
+               pbprefetch(pb.workp + pfdist + 64);
+               pbprefetch(pb.workp + pfdist + 128);
+               pbprefetch(pb.workp + pfdist + PACKETSIZE-1);
+            }
+
+            if (*(pb.workp) == 0x47)
+            {
+               if(job->filter == NULL)
+                  decode_packet((unsigned char *)pb.workp);
+               else if(tsfilter_keep(&tf, (unsigned char *)pb.workp))
+               {
+                  /* kept packets are moved down over dropped ones */
+                  decode_packet((unsigned char *)pb.workp);
+                  if(keepp != pb.workp)
+                     memcpy(keepp, pb.workp, PACKETSIZE);
+                  keepp += PACKETSIZE;
+               }
+               pb.workp += PACKETSIZE;
+            }
+            else
+            {
+               if(enable_perfcnt)
+                  perfcnt_stop(&perfcnt);
+
+               stats_latency(LAT_DECRYPT, t);
+               PROBE2(chunk__decrypted, pboffset(&pb, chunkp), pb.workp - chunkp);
+               PROBE1(resync, pboffset(&pb, pb.workp));
+               stats.resyncs++;
+               resyncs++;
+
+               if(job->filter != NULL)
+                  pbcut(&pb, keepp);
+
+               t = stats_now();
+               pbwrite(&pb);
+               stats_latency(LAT_WRITE, t);
+               goto resync;
+            }
+         }
+
+         if(enable_perfcnt)
+            perfcnt_stop(&perfcnt);
+
+         stats_latency(LAT_DECRYPT, t);
+         PROBE2(chunk__decrypted, pboffset(&pb, chunkp), pb.workp - chunkp);
+
+         if(job->filter != NULL)
+            pbcut(&pb, keepp);
+
+         t = stats_now();
+         pbwrite(&pb);
+         stats_latency(LAT_WRITE, t);
+         stats_latency(LAT_CHUNK, tchunk);
+
+         /* everything before a checkpoint must be on disk first */
+         if(pb.hash != NULL && job->filter == NULL && pb.end == 0 &&
+            pb.rdbytes - checkpoint >= JOURNAL_CHECKPOINT)
+         {
+            if(pbflush(&pb) == 0 && journal_syncfile(pb.fdwrite) == 0)
+            {
+               checkpoint = pb.wrbytes;
+               journal_record(JR_CHECKPOINT, srffile, job->outdir, job->priority, checkpoint, jh.h);
+            }
+         }
+
+         progress_update(&pg, pb.rdbytes, resyncs);
+         ATOMIC_STORE(&job->done, pb.rdbytes);
+         stats_tick(metricsfile);
+
+         if(job->stop != NULL && ATOMIC_LOAD(job->stop))
+         {
+            trace(TRC_WARN, "Stopped %s at offset %llu", srffile, pb.rdbytes);
+            stopped = 1;
+            break;
+         }
+      }
+   }
+
+   if(!stopped)
+      pbwrite(&pb);
+
+   /* a failed read or write must not end up journaled as done */
+   if(stopped || pb.error != 0)
+   {
+      close(pb.fdwrite);
+      close(pb.fdread);
+      pbfree(&pb);
+      freedrmkey();
+      return 1;
+   }
+
+   progress_end(&pg, pb.rdbytes, resyncs);
+   ATOMIC_STORE(&job->done, pb.rdbytes);
+
+   if(pb.hash != NULL)
+   {
+      job->hash = jhash_final(&jh);
+      if(journal_syncfile(pb.fdwrite) != 0)
+      {
+         close(pb.fdwrite);
+         close(pb.fdread);
+         pbfree(&pb);
+         freedrmkey();
+         return 1;
+      }
+   }
+
+   if(enable_perfcnt)
+      perfcnt_report(&perfcnt, srffile, pb.rdbytes, stats.packets - packets);
+
+   /* NFS and the like report failed writeback on close */
+   if(close(pb.fdwrite) != 0)
+   {
+      trace(TRC_ERROR, "Cannot write %s: %s", outfile, strerror(errno));
+      close(pb.fdread);
+      pbfree(&pb);
+      freedrmkey();
+      return 1;
+   }
+   close(pb.fdread);
+   pbfree(&pb);
+   freedrmkey();
+
+   mem_snapshot(&now);
+   trace(TRC_INFO, "Memory: %llu bytes in %llu allocations, %llu bytes still in use",
+         now.allocated - mem.allocated, now.allocs - mem.allocs,
+         now.inuse - mem.inuse);
+
+   return 0;
+}
+
+/*
+ * Set up a job, resuming it from the journal if it has a checkpoint
+ * there.
+ */
+void decrypt_job_init(struct decrypt_job *job, const char *srffile, const char *outdir)
+{
+   struct jentry *e;
+
+   memset(job, 0, sizeof(*job));
+   job->srffile = srffile;
+   job->outdir = outdir;
+   job->journal = journaling;
+   job->hash = JHASH_BASIS;
+
+   if(journaling && (e = journal_lookup(srffile)) != NULL && e->state != JR_DONE)
+   {
+      job->offset = e->offset;
+      job->hash = e->hash;
+   }
+}
+
+int decryptsrf(struct decrypt_job *job)
+{
+   int ret;
+
+   ret = decryptjob(job);
+
+   if(job->journal)
+      journal_record(ret != 0 ? JR_FAILED : JR_DONE, job->srffile, job->outdir,
+         job->priority, ATOMIC_LOAD(&job->done), job->hash);
+
+   return ret;
+}
+
+/*
+ * Parse a size with optional K, M or G suffix, 0 on error
+ */
+size_t parsesize(const char *str)
+{
+   char *end;
+   unsigned long long val;
+
+   val = strtoull(str, &end, 10);
+   switch(*end)
+   {
+      case 'g': case 'G': val <<= 10; /* fall through */
+      case 'm': case 'M': val <<= 10; /* fall through */
+      case 'k': case 'K': val <<= 10; end++; break;
+      case '\0': break;
+      default: return 0;
+   }
+
+   return *end == '\0' ? (size_t)val : 0;
+}
+
+/*
+ * Parse a non-negative decimal count, -1 on error
+ */
+int parsecount(const char *str)
+{
+   char *end;
+   long val;
+
+   errno = 0;
+   val = strtol(str, &end, 10);
+   if(end == str || *end != '\0' || errno != 0 || val < 0 || val > INT_MAX)
+      return -1;
+
+   return (int)val;
+}
+
+/*
+ * Per thread setup for decryptsrf(): performance counters and the
+ * buffer arena, mapped by the thread itself so it is node local.
+ */
+void decrypt_thread_init(struct arena *arena)
+{
+   if(enable_perfcnt)
+      perfcnt_open(&perfcnt);
+
+   if(arena_init(arena, PBSIZE(iosize) + ARENA_SIZE, arenaflags) == 0)
+   {
+      mem_use_arena(arena);
+
+      if((arenaflags & ARENA_HUGEPAGES) && arena->pages == ARENA_SMALLPAGES)
+         trace(TRC_WARN, "no hugepages available, using small pages");
+      trace(TRC_INFO, "Buffer arena %lu bytes (%s)", (unsigned long)arena->size,
+            arena->pages == ARENA_HUGETLB ? "hugetlb" : arena->pages == ARENA_THP ? "thp" : "4k pages");
+   }
+   else
+   {
+#ifdef LOWMEM
+      trace(TRC_ERROR, "I/O size %lu does not fit the %d byte working buffer",
+            (unsigned long)iosize, ARENA_STATIC);
+      exit(EXIT_FAILURE);
+#else
+      trace(TRC_WARN, "cannot map buffer arena, using heap");
+#endif
+   }
+}
+
+void decrypt_thread_exit(struct arena *arena)
+{
+   mem_use_arena(NULL);
+   arena_destroy(arena);
+
+   if(enable_perfcnt)
+      perfcnt_close(&perfcnt);
+}
@@ -0,0 +1,100 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _DECRYPT_H_
+#define _DECRYPT_H_
+
+#include <stddef.h>
+#include <limits.h>
+
+#include "perfcnt.h"
+#include "thread.h"
+
+struct arena;
+
+/*
+ * Packet filter of a job. Packets of other PIDs are dropped, PID 0
+ * (PAT) is always kept. Times are seconds from the first PCR in the
+ * recording, end 0 for no end.
+ */
+#define FILTER_PIDS  16
+
+struct tsfilter
+{
+   int npids;
+   unsigned short pids[FILTER_PIDS];
+   double start;
+   double end;
+};
+
+/*
+ * Metadata of a recording read ahead by the batch (batch.h) while
+ * other files are decrypted, so a job can start without waiting for
+ * its .mdb and .inf.
+ */
+struct decrypt_meta
+{
+   int valid;                    /* key was read */
+   unsigned char key[16];        /* from the .mdb */
+   char outname[PATH_MAX];       /* from the .inf, empty without one */
+};
+
+/*
+ * One recording to decrypt. decryptsrf() keeps all of its state on the
+ * stack or in thread locals, so any number of threads can run jobs at
+ * the same time. total and done are updated while the job runs and can
+ * be read from other threads with ATOMIC_LOAD().
+ *
+ * With journal set the job is recorded in the journal (journal.h) and
+ * resumed at offset, a checkpoint with output hash state hash. When it
+ * is done hash is the hash of the whole output. Filtered jobs always
+ * start over since their output offsets differ from the input.
+ */
+struct decrypt_job
+{
+   const char *srffile;
+   const char *outdir;           /* with trailing '/' */
+   size_t iosize;                /* 0 for the -b default */
+   const char *outfile;          /* instead of the name from the .inf */
+   const unsigned char *key;     /* instead of the key from the .mdb */
+   const struct decrypt_meta *meta; /* read ahead, or NULL */
+   const char *mdbfile;          /* paired by the -r walk, NULL to derive */
+   const char *inffile;          /* from srffile; "" if there is none */
+   const struct tsfilter *filter;
+   const unsigned long long *stop; /* stop early once set, or NULL */
+   int journal;
+   int priority;                 /* only recorded in the journal */
+   unsigned long long offset;
+   unsigned long long hash;
+   unsigned long long total;
+   unsigned long long done;
+};
+
+/* settings shared by all jobs */
+extern int enable_aesni;
+extern int enable_perfcnt;
+extern char *metricsfile;
+extern size_t iosize;
+extern int prefetch;
+extern int dropcache;
+extern int arenaflags;
+extern THREAD_LOCAL struct perfcnt perfcnt;
+
+extern int Check_CPU_support_AES(void);
+extern char *filename(char *path, const char *newsuffix);
+extern size_t parsesize(const char *str);
+extern int parsecount(const char *str);
+extern void decrypt_readmeta(struct decrypt_meta *meta, const char *srffile,
+   const char *mdbfile, const char *inffile);
+extern void decrypt_job_init(struct decrypt_job *job, const char *srffile, const char *outdir);
+extern int decryptsrf(struct decrypt_job *job);
+extern void decrypt_thread_init(struct arena *arena);
+extern void decrypt_thread_exit(struct arena *arena);
+
+#endif /* _DECRYPT_H_ */
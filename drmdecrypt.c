@@ -19,13 +19,32 @@
 #else
 #include <libgen.h>
 #include <unistd.h>
-#include <cpuid.h>
+#include <getopt.h>
 #endif
 
 
 #include "aes.h"
+#include "decrypt.h"
 #include "trace.h"
+#include "tracering.h"
+#include "probes.h"
 #include "buffer.h"
+#include "stats.h"
+#include "progress.h"
+#include "perfcnt.h"
+#include "mem.h"
+#include "arena.h"
+#include "affinity.h"
+#include "batch.h"
+#include "claim.h"
+#include "iosched.h"
+#include "journal.h"
+#include "throttle.h"
+#include "thread.h"
+
+#ifndef O_BINARY
+#define O_BINARY  0
+#endif
 
 /* Helper macros */
 #define STR_HELPER(x) #x
@@ -37,400 +56,229 @@
 #endif
 #define VERSION	  "1.0"
 
-block_state state;
-int enable_aesni = 0;
+/* long only options */
+enum {
+   OPT_PROGRESS = 256,
+   OPT_PROGRESS_FD,
+   OPT_PERF_COUNTERS,
+   OPT_LATENCY,
+   OPT_HUGEPAGES,
+   OPT_DROP_CACHE,
+   OPT_PREFETCH,
+   OPT_SSD_READERS,
+   OPT_PHYSICAL_ORDER,
+   OPT_MAX_READ_MBPS,
+   OPT_MAX_WRITE_MBPS,
+   OPT_THROTTLE_LATENCY,
+   OPT_CPUS,
+   OPT_MAX_BUFFER_MEM,
+   OPT_CLAIM_DIR,
+   OPT_LEASE,
+   OPT_JOURNAL,
+   OPT_JOBS
+};
+
+int tracelevel = TRC_WARN;
+char outdir[PATH_MAX];
 
 
-/*
- * Check for AES-NI CPU support
- */
-int Check_CPU_support_AES()
+void usage(void)
 {
-#if defined(__INTEL_COMPILER)
-   int CPUInfo[4] = {-1};
-   __cpuid(CPUInfo, 1);
-   return (CPUInfo[2] & 0x2000000);
-#else
-   unsigned int a=1,b,c,d;
-   __cpuid(1, a,b,c,d);
-   return (c & 0x2000000);
+   fprintf(stderr, "Usage: drmdecrypt [-dqvx][-b size][-j jobs][-m file][-o outdir] infile.srf ...\n");
+   fprintf(stderr, "       drmdecrypt [-dqvx][-b size][-j jobs][-m file][-o outdir] --jobs=manifest\n");
+   fprintf(stderr, "       drmdecrypt [-dqvx][-b size][-j jobs][-m file][-o outdir] -r dir ...\n");
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, "   -b size    I/O chunk size, e.g. 4M (default %dK)\n", DEFAULT_IOSIZE/1024);
+   fprintf(stderr, "   -d         Show debugging output\n");
+   fprintf(stderr, "   -j jobs    Decrypt files in parallel, 0 for one per CPU, auto to adapt (default 1)\n");
+   fprintf(stderr, "   -m file    Write Prometheus metrics to file\n");
+   fprintf(stderr, "   -o outdir  Output directory\n");
+   fprintf(stderr, "   -q         Be quiet. Only error output.\n");
+   fprintf(stderr, "   -r         Decrypt all recordings below the given directories\n");
+#ifdef ENABLE_TRACERING
+   fprintf(stderr, "   -T file    Dump binary trace ring to file on exit\n");
 #endif
+   fprintf(stderr, "   -v         Version information\n");
+   fprintf(stderr, "   -x         Disable AES-NI support\n");
+   fprintf(stderr, "   --progress=json      Report progress as JSON lines\n");
+   fprintf(stderr, "   --progress-fd=fd     File descriptor for progress (default 2)\n");
+   fprintf(stderr, "   --perf-counters      Report CPU performance counters per file\n");
+   fprintf(stderr, "   --latency            Report latency percentiles on exit\n");
+   fprintf(stderr, "   --hugepages          Allocate I/O buffers from 2M hugepages\n");
+   fprintf(stderr, "   --drop-cache         Keep input and output out of the page cache\n");
+   fprintf(stderr, "   --ssd-readers=N      Concurrent readers per SSD, 0 unlimited (default 0)\n");
+   fprintf(stderr, "   --physical-order     Read files and chunks in order of disk address\n");
+   fprintf(stderr, "   --max-read-mbps=N    Limit reading to N MB/s over all files\n");
+   fprintf(stderr, "   --max-write-mbps=N   Limit writing to N MB/s over all files\n");
+   fprintf(stderr, "   --throttle-latency=ms  Lower the read limit while read() takes longer\n");
+   fprintf(stderr, "   --cpus=list          Run workers on these CPUs only, e.g. 0-3,8\n");
+   fprintf(stderr, "   --max-buffer-mem=size  Share this much buffer memory between all files\n");
+   fprintf(stderr, "   --claim-dir=dir      Share the batch with other processes through dir\n");
+   fprintf(stderr, "   --lease=seconds      Take over claims not renewed for this long (default " STR(CLAIM_LEASE) ")\n");
+   fprintf(stderr, "   --journal=file       Record progress in file, skip or resume files from it\n");
+   fprintf(stderr, "   --jobs=manifest      Read files and per file options from manifest, - for stdin\n");
+   fprintf(stderr, "   --prefetch=K         Prefetch K packets ahead, 0 disables (default " STR(PREFETCH_PACKETS) ")\n");
+   fprintf(stderr, "\n");
 }
 
-
-char *filename(char *path, char *newsuffix)
+/*
+ * Batch worker. Decrypts files until the batch is done, with buffers
+ * from its own arena and its own performance counters. It is placed
+ * on its NUMA node before the arena is touched.
+ */
+void *batch_worker(void *arg)
 {
-   char *end = path + strlen(path);
-
-   while(*end != '.' && *end != '/')
-      --end;
+   struct batch *b = arg;
+   struct decrypt_job job;
+   struct arena arena;
+   struct mentry e;
+   char dir[PATH_MAX], tmp[PATH_MAX];
+   int ret;
 
-   if(newsuffix != NULL)
-      strcpy(++end, newsuffix);
-   else
-      *end = '\0';
+   affinity_worker(batch_worker_id(b));
 
-   return path;
-}
+   decrypt_thread_init(&arena);
 
-int readdrmkey(char *mdbfile)
-{
-   unsigned char drmkey[0x10];
-   char tmpbuf[64];
-   unsigned int j;
-   FILE *mdbfp;
-
-   memset(tmpbuf, '\0', sizeof(tmpbuf));
-   memset(&state, 0, sizeof(block_state));
-   state.rounds = 10;
-
-   if((mdbfp = fopen(mdbfile, "rb")))
+   while(batch_next(b, &e) != NULL)
    {
-      fseek(mdbfp, 8, SEEK_SET);
-      for (j = 0; j < 0x10; j++){
-         if(fread(&drmkey[(j&0xc)+(3-(j&3))], sizeof(unsigned char), 1, mdbfp) != 1){
-            trace(TRC_ERROR, "short read while reading DRM key");
-            return 1;
-         }
-      }
-      fclose(mdbfp);
-
-      for (j = 0; j < sizeof(drmkey); j++)
-         sprintf(tmpbuf+strlen(tmpbuf), "%02X ", drmkey[j]);
-
-      trace(TRC_INFO, "drm key successfully read from %s", basename(mdbfile));
-      trace(TRC_INFO, "KEY: %s", tmpbuf);
-
-      if(enable_aesni)
-         block_init_aesni(&state, drmkey, BLOCK_SIZE);
+      arena_reset(&arena);
+
+      /* -r mirrors the tree below -o, without -o manifest entries
+         and found files go next to their input */
+      if(e.outdir[0] != '\0')
+         strcpy(dir, e.outdir);
+      else if(outdir[0] != '\0')
+         strcpy(dir, outdir);
       else
-         block_init_aes(&state, drmkey, BLOCK_SIZE);
-
-      return 0;
-   }
-   else
-      trace(TRC_ERROR, "mdb file %s not found", basename(mdbfile));
-
-   return 1;
-}
-
-int genoutfilename(char *outfile, char *inffile)
-{
-   FILE *inffp;
-   unsigned char inf[0x200];
-   char tmpname[PATH_MAX];
-   int i;
-
-   if((inffp = fopen(inffile, "rb")))
-   {
-      fseek(inffp, 0, SEEK_SET);
-      if(fread(inf, sizeof(unsigned char), 0x200, inffp) != 0x200){
-         trace(TRC_ERROR, "short read while reading inf file");
-         return 1;
+      {
+         strcpy(tmp, e.file);
+         snprintf(dir, sizeof(dir), "%s/", dirname(tmp));
       }
-      fclose(inffp);
-
-      /* build base path */
-      strcpy(tmpname, basename(inffile));
-      filename(tmpname, NULL);
-      strcat(tmpname, "-");
-      
-      /* http://code.google.com/p/samy-pvr-manager/wiki/InfFileStructure */
 
-      /* copy channel name and program title */
-      for(i=1; i < 0x200; i += 2)
+      decrypt_job_init(&job, e.file, dir);
+      job.outfile = e.outfile;
+      job.meta = &e.meta;
+      if(e.paired)
       {
-         if (inf[i])
-         {
-            if((inf[i] >= 'A' && inf[i] <= 'z') || (inf[i] >= '0' && inf[i] <= '9'))
-               strncat(tmpname, (char*)&inf[i], 1);
-            else
-               strcat(tmpname, "_");
-         }
-         if (i == 0xFF) {
-            strcat(tmpname, "_-_");
-         }
+         job.mdbfile = e.mdbfile;
+         job.inffile = e.inffile;
       }
+      if(e.haskey)
+         job.key = e.key;
+      if(e.hasfilter)
+         job.filter = &e.filter;
+      job.stop = &e.lost;
 
-      strcat(tmpname, ".ts");
-
-      strcat(outfile, tmpname);
-   }
-   else
-      return 1;
-
-   return 0;
-}
-
-
-int decrypt_aes128cbc(unsigned char *pin, int len, unsigned char *pout)
-{
-   int i;
-
-   if(len % BLOCK_SIZE != 0)
-   {
-      trace(TRC_ERROR, "Decrypt length needs to be a multiple of BLOCK_SIZE");
-      return 1;
-   }
-
-   for(i=0; i < len; i+=BLOCK_SIZE)
-   {
-      if(enable_aesni)
-         block_decrypt_aesni(&state, pin + i, pout + i);
-      else
-         block_decrypt_aes(&state, pin + i, pout + i);
-   }
-
-   return 0;
-}
-
+      ret = decryptsrf(&job);
 
-/*
- * Decode a MPEG packet
- *
- * Transport Stream Header:
- * ========================
- *
- * Name                    | bits | byte msk | Description
- * ------------------------+------+----------+-----------------------------------------------
- * sync byte               | 8    | 0xff     | Bit pattern from bit 7 to 0 as 0x47
- * Transp. Error Indicator | 1    | 0x80     | Set when a demodulator cannot correct errors from FEC data
- * Payload Unit start ind. | 1    | 0x40     | Boolean flag with a value of true means the start of PES
- *                         |      |          | data or PSI otherwise zero only.
- * Transport Priority      | 1    | 0x20     | Boolean flag with a value of true means the current packet
- *                         |      |          | has a higher priority than other packets with the same PID.
- * PID                     | 13   | 0x1fff   | Packet identifier
- * Scrambling control      | 2    | 0xc0     | 00 = not scrambled
- *                         |      |          | 01 = Reserved for future use (DVB-CSA only)
- *                         |      |          | 10 = Scrambled with even key (DVB-CSA only)
- *                         |      |          | 11 = Scrambled with odd key (DVB-CSA only)
- * Adaptation field exist  | 1    | 0x20     | Boolean flag
- * Contains payload        | 1    | 0x10     | Boolean flag
- * Continuity counter      | 4    | 0x0f     | Sequence number of payload packets (0x00 to 0x0F)
- *                         |      |          | Incremented only when a playload is present
- *
- * Adaptation Field:
- * ========================
- *
- * Name                    | bits | byte msk | Description
- * ------------------------+------+----------+-----------------------------------------------
- * Adaptation Field Length | 8    | 0xff     | Number of bytes immediately following this byte
- * Discontinuity indicator | 1    | 0x80     | Set to 1 if current TS packet is in a discontinuity state
- * Random Access indicator | 1    | 0x40     | Set to 1 if PES packet starts a video/audio sequence
- * Elementary stream prio  | 1    | 0x20     | 1 = higher priority
- * PCR flag                | 1    | 0x10     | Set to 1 if adaptation field contains a PCR field
- * OPCR flag               | 1    | 0x08     | Set to 1 if adaptation field contains a OPCR field
- * Splicing point flag     | 1    | 0x04     | Set to 1 if adaptation field contains a splice countdown field
- * Transport private data  | 1    | 0x02     | Set to 1 if adaptation field contains private data bytes
- * Adapt. field extension  | 1    | 0x01     | Set to 1 if adaptation field contains extension
- * Below fields optional   |      |          | Depends on flags
- * PCR                     | 33+6+9 |        | Program clock reference
- * OPCR                    | 33+6+9 |        | Original Program clock reference
- * Splice countdown        | 8    | 0xff     | Indicates how many TS packets from this one a splicing point
- *                         |      |          | occurs (may be negative)
- * Stuffing bytes          | 0+   |          |
- *
- *
- * See: http://en.wikipedia.org/wiki/MPEG_transport_stream
- */
-int decode_packet(unsigned char *data)
-{
-   unsigned char tmp[PACKETSIZE];
-   int offset;
-
-   if(data[0] != 0x47)
-   {
-      trace(TRC_ERROR, "Not a valid MPEG packet!");
-      return 1;
-   }
-
-   memcpy(tmp, data, PACKETSIZE);
-   
-   trace(TRC_DEBUG, "-------------------");
-   trace(TRC_DEBUG, "Trans. Error Indicator: 0x%x", data[2] & 0x80);
-   trace(TRC_DEBUG, "Payload Unit start Ind: 0x%x", data[2] & 0x40);
-   trace(TRC_DEBUG, "Transport Priority    : 0x%x", data[2] & 0x20);
-   trace(TRC_DEBUG, "Scrambling control    : 0x%x", data[3] & 0xC0);
-   trace(TRC_DEBUG, "Adaptation field exist: 0x%x", data[3] & 0x20);
-   trace(TRC_DEBUG, "Contains payload      : 0x%x", data[3] & 0x10);
-   trace(TRC_DEBUG, "Continuity counter    : 0x%x", data[3] & 0x0f);
-
-   /* only process scrambled content */
-   if(((data[3] & 0xC0) != 0xC0) && ((data[3] & 0xC0) != 0x80))
-     return 1;
-
-   if(data[3] & 0x20)
-	   trace(TRC_DEBUG, "Adaptation Field length: 0x%x", data[4]+1);
-
-   offset=4;
-
-   /* skip adaption field */
-   if(data[3] & 0x20)
-      offset += (data[4]+1);
-
-   /* remove scrambling bits */
-   tmp[3] &= 0x3f;
-
-   /* decrypt only full blocks (they seem to avoid padding) */
-   decrypt_aes128cbc(data + offset, ((PACKETSIZE - offset)/BLOCK_SIZE)*BLOCK_SIZE, tmp + offset);
-
-   memcpy(data, tmp, sizeof(tmp));
-
-   return 0;
-}
-
-int decryptsrf(char *srffile, char *outdir)
-{
-   char mdbfile[PATH_MAX];
-   char inffile[PATH_MAX];
-   char outfile[PATH_MAX];
-   struct packetbuffer pb;
-   int retries, sync_find = 0;
-   unsigned long filesize = 0;
-   unsigned long i;
-
-   memset(&pb, '\0', sizeof(pb));
-   memset(inffile, '\0', sizeof(inffile));
-   memset(mdbfile, '\0', sizeof(mdbfile));
-   memset(outfile, '\0', sizeof(outfile));
-
-   strcpy(inffile, srffile);
-   filename(inffile, "inf");
-
-   strcpy(mdbfile, srffile);
-   filename(mdbfile, "mdb");
-
-   /* read drm key from .mdb file */
-   if(readdrmkey(mdbfile) != 0)
-      return 1;
-
-   /* generate outfile name based on title from .inf file */
-   strcpy(outfile, outdir);
-   if(genoutfilename(outfile, inffile) != 0)
-   {
-      strcat(outfile, srffile);
-      filename(outfile, "ts");
-   }
-
-   trace(TRC_INFO, "Writing to %s", outfile);
-
-   pbinit(&pb);
-
-#ifdef _MSC_VER
-   int wmode = _S_IWRITE;
-   int binaryflag =  _O_BINARY;
-#else
-   mode_t wmode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-   int binaryflag = 0;
-#endif
-   pb.fdwrite = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | binaryflag, wmode);
-   if(pb.fdwrite == -1)
-   {
-      trace(TRC_ERROR, "Cannot open %s for writing", outfile);
-      return 1;
-   }
-
-   pb.fdread = open(srffile, O_RDONLY | binaryflag);
-   if(pb.fdread == -1)
-   {
-      trace(TRC_ERROR, "Cannot open %s for reading", srffile);
-      return 1;
-   }
-	
-
-   /* calculate filesize */
-   filesize = lseek(pb.fdread, 0, SEEK_END);
-   lseek(pb.fdread, 0, SEEK_SET);
-
-   trace(TRC_INFO, "Filesize %ld", filesize);
-
-resync:
-
-   /* try to sync */
-   sync_find = 0;
-   retries = 10;
-
-   while(sync_find == 0 && retries-- > 0)
-   {
-      pbread(&pb);
-
-      /* search packets starting with 0x47 */
-      for(i=0; i < (BUFFERSIZE-PACKETSIZE-PACKETSIZE); i++)
+      /* with the claim taken over the new owner decrypts the file,
+         that does not fail the batch */
+      if(ret != 0 && ATOMIC_LOAD(&e.lost))
       {
-         if (*(pb.workp+i) == 0x47 && *(pb.workp+i+PACKETSIZE) == 0x47 && *(pb.workp+i+PACKETSIZE+PACKETSIZE) == 0x47)
-         {
-            sync_find = 1;
-            pb.workp += i;
-
-            trace(TRC_INFO, "synced at offset %ld", pb.workp-pb.startp);
-
-            break;
-         }
+         batch_done(b, e.file, 0);
+         continue;
       }
-   }
 
-   if (sync_find)
-   {
-      while(pb.end == 0)
-      {
-         pbread(&pb);
+      batch_done(b, e.file, ret);
 
-         while(pb.workp+PACKETSIZE <= pb.endp)
-         {
-            if (*(pb.workp) == 0x47)
-            {
-               decode_packet((unsigned char *)pb.workp);
-               pb.workp += PACKETSIZE;
-            }
-            else
-            {
-               pbwrite(&pb);
-               goto resync;
-            }
-         }
-
-         pbwrite(&pb);
+      if(ret != 0)
+      {
+         stats.files_failed++;
+         break;
       }
-   }
 
-   pbwrite(&pb);
+      stats.files_done++;
+      stats_tick(metricsfile);
+   }
 
-   close(pb.fdwrite);
-   close(pb.fdread);
-   pbfree(&pb);
+   stats_flush();
 
-   return 0;
-}
+   decrypt_thread_exit(&arena);
 
-void usage(void)
-{
-   fprintf(stderr, "Usage: drmdecrypt [-dqvx][-o outdir] infile.srf ...\n");
-   fprintf(stderr, "Options:\n");
-   fprintf(stderr, "   -d         Show debugging output\n");
-   fprintf(stderr, "   -o outdir  Output directory\n");
-   fprintf(stderr, "   -q         Be quiet. Only error output.\n");
-   fprintf(stderr, "   -v         Version information\n");
-   fprintf(stderr, "   -x         Disable AES-NI support\n");
-   fprintf(stderr, "\n");
+   return NULL;
 }
 
 int main(int argc, char *argv[])
 {
-   char outdir[PATH_MAX];
+   char *tracefile = NULL;
+   char *cpulist = NULL;
+   char *claimdir = NULL;
+   char *journalfile = NULL;
+   char *manifestfile = NULL;
+   struct manifest manifest;
+   struct walk walk;
+   int recursive = 0;
+   int lease = CLAIM_LEASE;
+   struct batch batch;
+   int progress = 0;
+   int progress_fd = 2;
+   int latency = 0;
+   int jobs = 1;
+   int adaptive = 0;
+   double maxread = 0, maxwrite = 0, throttlelat = 0;
    int ch;
 
+   static struct option longopts[] = {
+      { "progress",    required_argument, NULL, OPT_PROGRESS },
+      { "progress-fd", required_argument, NULL, OPT_PROGRESS_FD },
+      { "perf-counters", no_argument,     NULL, OPT_PERF_COUNTERS },
+      { "latency",     no_argument,       NULL, OPT_LATENCY },
+      { "hugepages",   no_argument,       NULL, OPT_HUGEPAGES },
+      { "drop-cache",  no_argument,       NULL, OPT_DROP_CACHE },
+      { "prefetch",    required_argument, NULL, OPT_PREFETCH },
+      { "ssd-readers", required_argument, NULL, OPT_SSD_READERS },
+      { "physical-order", no_argument,    NULL, OPT_PHYSICAL_ORDER },
+      { "max-read-mbps",  required_argument, NULL, OPT_MAX_READ_MBPS },
+      { "max-write-mbps", required_argument, NULL, OPT_MAX_WRITE_MBPS },
+      { "throttle-latency", required_argument, NULL, OPT_THROTTLE_LATENCY },
+      { "cpus",        required_argument, NULL, OPT_CPUS },
+      { "max-buffer-mem", required_argument, NULL, OPT_MAX_BUFFER_MEM },
+      { "claim-dir",   required_argument, NULL, OPT_CLAIM_DIR },
+      { "lease",       required_argument, NULL, OPT_LEASE },
+      { "journal",     required_argument, NULL, OPT_JOURNAL },
+      { "jobs",        required_argument, NULL, OPT_JOBS },
+      { NULL,          0,                 NULL, 0 }
+   };
+
    memset(outdir, '\0', sizeof(outdir));
 
    enable_aesni = Check_CPU_support_AES();
 
-   while ((ch = getopt(argc, argv, "do:qvx")) != -1)
+   while ((ch = getopt_long(argc, argv, "b:dj:m:o:qrT:vx", longopts, NULL)) != -1)
    {
       switch (ch)
       {
+         case 'b':
+            iosize = parsesize(optarg);
+            if(iosize < READSIZE)
+            {
+               fprintf(stderr, "Invalid I/O size %s, minimum is %d\n", optarg, READSIZE);
+               exit(EXIT_FAILURE);
+            }
+            /* keep reads page aligned */
+            iosize = (iosize + PBALIGN-1) & ~(size_t)(PBALIGN-1);
+            break;
          case 'd':
             if(tracelevel > TRC_DEBUG)
                tracelevel--;
             break;
+         case 'j':
+            if(strcmp(optarg, "auto") == 0)
+            {
+               adaptive = 1;
+               jobs = 0;
+               break;
+            }
+            jobs = parsecount(optarg);
+            if(jobs < 0)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 'm':
+            metricsfile = optarg;
+            break;
          case 'o':
             strcpy(outdir, optarg);
             break;
@@ -438,6 +286,12 @@ int main(int argc, char *argv[])
             if(tracelevel < TRC_ERROR)
                tracelevel++;
             break;
+         case 'r':
+            recursive = 1;
+            break;
+         case 'T':
+            tracefile = optarg;
+            break;
          case 'v':
             fprintf(stderr, "drmdecrypt %s (%s)\n\n", VERSION, STR(REVISION));
             fprintf(stderr, "Source: http://github.com/decke/drmdecrypt\n");
@@ -446,33 +300,220 @@ int main(int argc, char *argv[])
          case 'x':
             enable_aesni = 0;
             break;
+         case OPT_PROGRESS:
+            if(strcmp(optarg, "json") != 0)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            progress = 1;
+            break;
+         case OPT_PROGRESS_FD:
+            progress_fd = parsecount(optarg);
+            if(progress_fd < 0)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case OPT_PERF_COUNTERS:
+            enable_perfcnt = 1;
+            break;
+         case OPT_LATENCY:
+            latency = 1;
+            break;
+         case OPT_HUGEPAGES:
+            arenaflags |= ARENA_HUGEPAGES;
+            break;
+         case OPT_DROP_CACHE:
+            dropcache = 1;
+            break;
+         case OPT_PREFETCH:
+            prefetch = parsecount(optarg);
+            if(prefetch < 0 || prefetch > 64)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case OPT_SSD_READERS:
+            ssdreaders = parsecount(optarg);
+            if(ssdreaders < 0)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case OPT_PHYSICAL_ORDER:
+            iosched_elevator = 1;
+            break;
+         case OPT_MAX_READ_MBPS:
+            maxread = atof(optarg);
+            break;
+         case OPT_MAX_WRITE_MBPS:
+            maxwrite = atof(optarg);
+            break;
+         case OPT_THROTTLE_LATENCY:
+            throttlelat = atof(optarg) / 1e3;
+            break;
+         case OPT_CPUS:
+            cpulist = optarg;
+            break;
+         case OPT_MAX_BUFFER_MEM:
+            membudget = parsesize(optarg);
+            if(membudget == 0)
+            {
+               fprintf(stderr, "Invalid buffer memory size %s\n", optarg);
+               exit(EXIT_FAILURE);
+            }
+            /* buffers are only resident while reserved */
+            arenaflags |= ARENA_LAZY;
+            break;
+         case OPT_CLAIM_DIR:
+            claimdir = optarg;
+            break;
+         case OPT_LEASE:
+            lease = parsecount(optarg);
+            if(lease < 1)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case OPT_JOURNAL:
+            journalfile = optarg;
+            break;
+         case OPT_JOBS:
+            manifestfile = optarg;
+            break;
          default:
             usage();
             exit(EXIT_FAILURE);
       }
    }
 
-   if(argc == optind)
+   if((argc == optind && manifestfile == NULL) || (argc == optind && recursive))
+   {
+      usage();
+      exit(EXIT_FAILURE);
+   }
+
+   if(progress)
+      progressfd = progress_fd;
+
+   /* probe once here, every worker opens its own counters */
+   if(enable_perfcnt)
+   {
+      if(perfcnt_open(&perfcnt) != 0)
+      {
+         trace(TRC_WARN, "hardware performance counters not available");
+         enable_perfcnt = 0;
+      }
+      perfcnt_close(&perfcnt);
+   }
+
+   if(maxread < 0 || maxwrite < 0 || throttlelat < 0)
    {
       usage();
       exit(EXIT_FAILURE);
    }
 
-   /* set and verify outdir */
-   if(strlen(outdir) < 1)
+   if(throttlelat > 0 && maxread == 0)
+      trace(TRC_WARN, "--throttle-latency needs --max-read-mbps as upper limit, ignored");
+
+   throttle_init(&rdthrottle, maxread, throttlelat);
+   throttle_init(&wrthrottle, maxwrite, 0);
+
+   if(affinity_init(cpulist) != 0)
+   {
+      fprintf(stderr, "Invalid CPU list %s\n", cpulist);
+      exit(EXIT_FAILURE);
+   }
+
+   if(jobs == 0)
+      jobs = affinity_ncpus();
+#ifdef LOWMEM
+   /* there is only one static working buffer */
+   jobs = 1;
+#endif
+
+   /* set and verify outdir, -r gets the root of the mirrored tree */
+   if(strlen(outdir) < 1 && argc > optind && !recursive)
       strcpy(outdir, dirname(argv[optind]));
 
-   if(outdir[strlen(outdir)-1] != '/')
+   if(strlen(outdir) > 0 && !recursive && outdir[strlen(outdir)-1] != '/')
       strcat(outdir, "/");
 
    trace(TRC_INFO, "AES-NI CPU support %s", enable_aesni ? "enabled" : "disabled");
 
-   do
+   if(jobs > 1)
+      trace(TRC_INFO, "Decrypting with %s%d workers", adaptive ? "up to " : "", jobs);
+
+   if(journalfile != NULL && journal_open(journalfile) != 0)
+      exit(EXIT_FAILURE);
+
+   batch_init(&batch, argv + optind, recursive ? 0 : argc - optind);
+   batch.adaptive = adaptive;
+   batch.journal = journaling;
+
+   if(claimdir != NULL)
    {
-      if(decryptsrf(argv[optind], outdir) != 0)
-         break;
+      if(claim_init(claimdir, lease) != 0)
+         exit(EXIT_FAILURE);
+      batch.claim = 1;
+   }
+   if(manifestfile != NULL)
+   {
+      if(manifest_open(&manifest, manifestfile) != 0)
+         exit(EXIT_FAILURE);
+      batch.manifest = &manifest;
+   }
+   if(recursive)
+   {
+      if(walk_start(&walk, argv + optind, argc - optind, outdir[0] != '\0' ? outdir : NULL) != 0)
+         exit(EXIT_FAILURE);
+      batch.walk = &walk;
+   }
+   if(iosched_elevator)
+   {
+      if(manifestfile != NULL || recursive)
+         trace(TRC_WARN, "--physical-order only sorts the files given on the command line");
+      batch_sort_physical(&batch);
    }
-   while(++optind < argc);
+   batch_run(&batch, jobs, batch_worker);
+
+   if(manifestfile != NULL)
+      manifest_close(&manifest);
+   if(recursive)
+      walk_finish(&walk);
+
+   trace(TRC_INFO, "Memory total: %llu bytes in %llu allocations, %llu in use, "
+         "peak %llu, peak RSS %llu", memstats.allocated, memstats.allocs,
+         memstats.inuse, memstats.peak, mem_peak_rss());
+
+   if(metricsfile != NULL && stats_write_prom(metricsfile) != 0)
+      trace(TRC_ERROR, "Cannot write metrics to %s", metricsfile);
+
+   if(latency)
+      stats_report_latency(stderr);
+
+#ifdef ENABLE_TRACERING
+   if(tracefile != NULL)
+   {
+      FILE *tracefp;
+
+      if((tracefp = fopen(tracefile, "w")))
+      {
+         trring_dump(tracefp);
+         fclose(tracefp);
+      }
+      else
+         trace(TRC_ERROR, "Cannot open %s for writing", tracefile);
+   }
+#else
+   if(tracefile != NULL)
+      trace(TRC_WARN, "trace ring not compiled in, rebuild with TRACERING=1");
+#endif
 
    return 0;
 }
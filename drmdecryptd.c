@@ -0,0 +1,722 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+/*
+ * drmdecryptd keeps a pool of decrypt workers running and takes jobs
+ * over a Unix domain socket, so recorders and media servers can hand
+ * over recordings without starting a process per file. The protocol
+ * is line based, one command per line:
+ *
+ *   SUBMIT file [-o outdir] [-p priority] [-b size]  ->  OK id
+ *   STATUS [id]       ->  one JSON object per job, then OK
+ *   CANCEL id         ->  OK, for jobs that have not started yet
+ *
+ * Errors are answered with "ERR message". Jobs with a higher priority
+ * run first, jobs with the same priority in the order they came in.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "decrypt.h"
+#include "trace.h"
+#include "buffer.h"
+#include "stats.h"
+#include "progress.h"
+#include "mem.h"
+#include "arena.h"
+#include "affinity.h"
+#include "journal.h"
+#include "thread.h"
+
+/* Helper macros */
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+/* Version Information */
+#ifndef REVISION
+#define REVISION  ""
+#endif
+#define VERSION	  "1.0"
+
+#define DAEMON_SOCKET  "/tmp/drmdecryptd.sock"
+#define DAEMON_KEEP    256      /* finished jobs kept for STATUS */
+#define DAEMON_LINE    (PATH_MAX+256)
+
+enum {
+   OPT_HUGEPAGES = 256,
+   OPT_DROP_CACHE,
+   OPT_CPUS,
+   OPT_MAX_BUFFER_MEM,
+   OPT_JOURNAL
+};
+
+enum {
+   JOB_QUEUED,
+   JOB_RUNNING,
+   JOB_DONE,
+   JOB_FAILED,
+   JOB_CANCELED
+};
+
+static const char *jobstates[] = { "queued", "running", "done", "failed", "canceled" };
+
+struct daemonjob
+{
+   unsigned long id;
+   int priority;
+   int state;
+   char srffile[PATH_MAX];
+   char outdir[PATH_MAX];
+   struct decrypt_job job;
+   struct daemonjob *next;
+};
+
+int tracelevel = TRC_WARN;
+
+static char defoutdir[PATH_MAX];
+
+/* all jobs in the order they were submitted */
+static struct daemonjob *jobs = NULL;
+static struct daemonjob **jobtail = &jobs;
+static unsigned long nextid = 1;
+static int nfinished = 0;
+static int stopping = 0;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+
+static volatile sig_atomic_t quit = 0;
+
+
+void usage(void)
+{
+   fprintf(stderr, "Usage: drmdecryptd [-dqvx][-b size][-j workers][-m file][-o outdir][-s socket]\n");
+   fprintf(stderr, "Options:\n");
+   fprintf(stderr, "   -b size    Default I/O chunk size, e.g. 4M (default %dK)\n", DEFAULT_IOSIZE/1024);
+   fprintf(stderr, "   -d         Show debugging output\n");
+   fprintf(stderr, "   -j workers Number of workers, 0 for one per CPU (default 0)\n");
+   fprintf(stderr, "   -m file    Write Prometheus metrics to file\n");
+   fprintf(stderr, "   -o outdir  Default output directory (default next to the input)\n");
+   fprintf(stderr, "   -q         Be quiet. Only error output.\n");
+   fprintf(stderr, "   -s socket  Listen on this Unix socket (default " DAEMON_SOCKET ")\n");
+   fprintf(stderr, "   -v         Version information\n");
+   fprintf(stderr, "   -x         Disable AES-NI support\n");
+   fprintf(stderr, "   --hugepages          Allocate I/O buffers from 2M hugepages\n");
+   fprintf(stderr, "   --drop-cache         Keep input and output out of the page cache\n");
+   fprintf(stderr, "   --cpus=list          Run workers on these CPUs only, e.g. 0-3,8\n");
+   fprintf(stderr, "   --max-buffer-mem=size  Share this much buffer memory between all jobs\n");
+   fprintf(stderr, "   --journal=file       Record jobs in file, resume unfinished ones on start\n");
+   fprintf(stderr, "\n");
+}
+
+/*
+ * Drop the oldest finished jobs beyond DAEMON_KEEP. Called with
+ * jobs_lock held.
+ */
+static void jobs_expire(void)
+{
+   struct daemonjob **jp = &jobs;
+   struct daemonjob *j;
+
+   while(nfinished > DAEMON_KEEP && *jp != NULL)
+   {
+      j = *jp;
+      if(j->state >= JOB_DONE)
+      {
+         *jp = j->next;
+         if(jobtail == &j->next)
+            jobtail = jp;
+         free(j);
+         nfinished--;
+      }
+      else
+         jp = &j->next;
+   }
+}
+
+/*
+ * Highest priority queued job, the oldest of them on a tie. Called
+ * with jobs_lock held.
+ */
+static struct daemonjob *jobs_pick(void)
+{
+   struct daemonjob *j, *best = NULL;
+
+   for(j = jobs; j != NULL; j = j->next)
+   {
+      if(j->state == JOB_QUEUED && (best == NULL || j->priority > best->priority))
+         best = j;
+   }
+
+   return best;
+}
+
+static struct daemonjob *jobs_find(unsigned long id)
+{
+   struct daemonjob *j;
+
+   for(j = jobs; j != NULL; j = j->next)
+   {
+      if(j->id == id)
+         return j;
+   }
+
+   return NULL;
+}
+
+static void jobs_queue(struct daemonjob *j)
+{
+   j->state = JOB_QUEUED;
+
+   pthread_mutex_lock(&jobs_lock);
+   j->id = nextid++;
+   *jobtail = j;
+   jobtail = &j->next;
+   pthread_cond_signal(&jobs_cond);
+   pthread_mutex_unlock(&jobs_lock);
+
+   stats_queue(1);
+
+   trace(TRC_INFO, "job %lu: queued %s with priority %d", j->id, j->srffile, j->priority);
+}
+
+/*
+ * Queue the jobs a previous daemon accepted but did not finish,
+ * resuming them from their last checkpoint.
+ */
+static void jobs_recover(void)
+{
+   struct daemonjob *j;
+   struct jentry *e;
+
+   for(e = journal_entries(); e != NULL; e = e->order)
+   {
+      if(e->state != JR_QUEUED && e->state != JR_RUNNING && e->state != JR_CHECKPOINT)
+         continue;
+
+      if(strlen(e->file) >= PATH_MAX || strlen(e->outdir) >= PATH_MAX ||
+         (j = calloc(1, sizeof(*j))) == NULL)
+         continue;
+
+      strcpy(j->srffile, e->file);
+      strcpy(j->outdir, e->outdir);
+      j->priority = e->priority;
+      decrypt_job_init(&j->job, j->srffile, j->outdir);
+      j->job.priority = j->priority;
+
+      jobs_queue(j);
+   }
+}
+
+/*
+ * Pool worker. Like the batch workers of drmdecrypt it has its own
+ * arena and counters and shares the buffer budget with all others.
+ */
+void *daemon_worker(void *arg)
+{
+   struct daemonjob *j = NULL;
+   struct arena arena;
+   int ret;
+
+   affinity_worker((int)(size_t)arg);
+
+   decrypt_thread_init(&arena);
+
+   for(;;)
+   {
+      pthread_mutex_lock(&jobs_lock);
+      while(!stopping && (j = jobs_pick()) == NULL)
+         pthread_cond_wait(&jobs_cond, &jobs_lock);
+      if(stopping)
+      {
+         pthread_mutex_unlock(&jobs_lock);
+         break;
+      }
+      j->state = JOB_RUNNING;
+      pthread_mutex_unlock(&jobs_lock);
+
+      stats_queue(-1);
+      arena_reset(&arena);
+
+      trace(TRC_INFO, "job %lu: decrypting %s", j->id, j->srffile);
+      ret = decryptsrf(&j->job);
+      if(ret != 0)
+         stats.files_failed++;
+      else
+         stats.files_done++;
+      stats_flush();
+      stats_tick(metricsfile);
+
+      pthread_mutex_lock(&jobs_lock);
+      j->state = ret != 0 ? JOB_FAILED : JOB_DONE;
+      nfinished++;
+      jobs_expire();
+      pthread_mutex_unlock(&jobs_lock);
+   }
+
+   decrypt_thread_exit(&arena);
+
+   return NULL;
+}
+
+static void reply_job(FILE *fp, struct daemonjob *j)
+{
+   char name[2*PATH_MAX];
+
+   progress_jsonstr(name, sizeof(name), j->srffile);
+   fprintf(fp, "{\"id\":%lu,\"state\":\"%s\",\"file\":\"%s\",\"priority\":%d,"
+      "\"bytes_done\":%llu,\"bytes_total\":%llu}\n", j->id, jobstates[j->state],
+      name, j->priority, ATOMIC_LOAD(&j->job.done), ATOMIC_LOAD(&j->job.total));
+}
+
+/*
+ * SUBMIT file [-o outdir] [-p priority] [-b size]
+ *
+ * The daemon does not know the working directory of the client, so
+ * file and outdir have to be absolute.
+ */
+static void cmd_submit(FILE *fp, char *args)
+{
+   struct daemonjob *j;
+   char *file, *opt, *val, *last, *end;
+   char tmp[PATH_MAX];
+   size_t io = 0;
+   long prio;
+
+   if((file = strtok_r(args, " \t", &last)) == NULL)
+   {
+      fprintf(fp, "ERR missing file\n");
+      return;
+   }
+   if(file[0] != '/')
+   {
+      fprintf(fp, "ERR %s is not an absolute path\n", file);
+      return;
+   }
+   if(strlen(file) >= PATH_MAX-8 || access(file, R_OK) != 0)
+   {
+      fprintf(fp, "ERR cannot read %s\n", file);
+      return;
+   }
+
+   if((j = calloc(1, sizeof(*j))) == NULL)
+   {
+      fprintf(fp, "ERR out of memory\n");
+      return;
+   }
+   strcpy(j->srffile, file);
+   strcpy(j->outdir, defoutdir);
+
+   while((opt = strtok_r(NULL, " \t", &last)) != NULL)
+   {
+      if((val = strtok_r(NULL, " \t", &last)) == NULL)
+         opt = "";
+
+      if(strcmp(opt, "-o") == 0 && val[0] != '/')
+      {
+         fprintf(fp, "ERR %s is not an absolute path\n", val);
+         free(j);
+         return;
+      }
+      else if(strcmp(opt, "-o") == 0 && strlen(val) < PATH_MAX-1)
+         strcpy(j->outdir, val);
+      else if(strcmp(opt, "-p") == 0)
+      {
+         errno = 0;
+         prio = strtol(val, &end, 10);
+         if(end == val || *end != '\0' || errno != 0 || prio < INT_MIN || prio > INT_MAX)
+         {
+            fprintf(fp, "ERR invalid priority %s\n", val);
+            free(j);
+            return;
+         }
+         j->priority = (int)prio;
+      }
+      else if(strcmp(opt, "-b") == 0 && parsesize(val) >= READSIZE)
+         io = (parsesize(val) + PBALIGN-1) & ~(size_t)(PBALIGN-1);
+      else
+      {
+         fprintf(fp, "ERR invalid option %s\n", opt);
+         free(j);
+         return;
+      }
+   }
+
+   /* same defaults as drmdecrypt */
+   if(strlen(j->outdir) < 1)
+   {
+      strcpy(tmp, j->srffile);
+      strcpy(j->outdir, dirname(tmp));
+   }
+   if(j->outdir[strlen(j->outdir)-1] != '/')
+      strcat(j->outdir, "/");
+
+   decrypt_job_init(&j->job, j->srffile, j->outdir);
+   j->job.iosize = io;
+   j->job.priority = j->priority;
+
+   /* an accepted job survives a crash */
+   if(journal_record(JR_QUEUED, j->srffile, j->outdir, j->priority, 0, 0) != 0)
+   {
+      fprintf(fp, "ERR cannot write journal\n");
+      free(j);
+      return;
+   }
+
+   jobs_queue(j);
+
+   fprintf(fp, "OK %lu\n", j->id);
+}
+
+static void cmd_status(FILE *fp, char *args)
+{
+   struct daemonjob *j;
+   unsigned long id = 0;
+
+   if(*args != '\0')
+      id = strtoul(args, NULL, 10);
+
+   pthread_mutex_lock(&jobs_lock);
+   if(id != 0)
+   {
+      if((j = jobs_find(id)) == NULL)
+      {
+         pthread_mutex_unlock(&jobs_lock);
+         fprintf(fp, "ERR no job %lu\n", id);
+         return;
+      }
+      reply_job(fp, j);
+   }
+   else
+   {
+      for(j = jobs; j != NULL; j = j->next)
+         reply_job(fp, j);
+   }
+   pthread_mutex_unlock(&jobs_lock);
+
+   fprintf(fp, "OK\n");
+}
+
+static void cmd_cancel(FILE *fp, char *args)
+{
+   struct daemonjob *j;
+   unsigned long id = strtoul(args, NULL, 10);
+   char srffile[PATH_MAX], outdir[PATH_MAX];
+   int priority = 0, state = -1;
+
+   /* once counted as finished the job may be expired and freed by
+      any worker, so what the journal needs is copied first */
+   pthread_mutex_lock(&jobs_lock);
+   if((j = jobs_find(id)) != NULL && (state = j->state) == JOB_QUEUED)
+   {
+      strcpy(srffile, j->srffile);
+      strcpy(outdir, j->outdir);
+      priority = j->priority;
+      j->state = JOB_CANCELED;
+      nfinished++;
+   }
+   pthread_mutex_unlock(&jobs_lock);
+
+   if(state == -1)
+      fprintf(fp, "ERR no job %lu\n", id);
+   else if(state != JOB_QUEUED)
+      fprintf(fp, "ERR job %lu is %s\n", id, jobstates[state]);
+   else
+   {
+      stats_queue(-1);
+      journal_record(JR_CANCELED, srffile, outdir, priority, 0, 0);
+      fprintf(fp, "OK\n");
+   }
+}
+
+/*
+ * One thread per client connection, answering commands until the
+ * client hangs up.
+ */
+void *daemon_client(void *arg)
+{
+   int fd = (int)(size_t)arg;
+   char line[DAEMON_LINE];
+   char *cmd, *args;
+   FILE *in, *fp;
+   int wfd;
+
+   if((wfd = dup(fd)) == -1 || (in = fdopen(fd, "r")) == NULL)
+   {
+      if(wfd != -1)
+         close(wfd);
+      close(fd);
+      return NULL;
+   }
+   if((fp = fdopen(wfd, "w")) == NULL)
+   {
+      close(wfd);
+      fclose(in);
+      return NULL;
+   }
+
+   while(fgets(line, sizeof(line), in) != NULL)
+   {
+      line[strcspn(line, "\r\n")] = '\0';
+
+      cmd = line;
+      args = line + strcspn(line, " \t");
+      if(*args != '\0')
+         *args++ = '\0';
+      args += strspn(args, " \t");
+
+      if(strcasecmp(cmd, "SUBMIT") == 0)
+         cmd_submit(fp, args);
+      else if(strcasecmp(cmd, "STATUS") == 0)
+         cmd_status(fp, args);
+      else if(strcasecmp(cmd, "CANCEL") == 0)
+         cmd_cancel(fp, args);
+      else if(*cmd != '\0')
+         fprintf(fp, "ERR unknown command %s\n", cmd);
+
+      if(fflush(fp) != 0)
+         break;
+   }
+
+   fclose(fp);
+   fclose(in);
+
+   return NULL;
+}
+
+static void sighandler(int sig)
+{
+   (void)sig;
+   quit = 1;
+}
+
+int main(int argc, char *argv[])
+{
+   char *sockpath = DAEMON_SOCKET;
+   char *cpulist = NULL;
+   char *journalfile = NULL;
+   struct sockaddr_un addr;
+   struct sigaction sa;
+   pthread_attr_t attr;
+   pthread_t *threads, tid;
+   int workers = 0;
+   int i, ch, sock, fd;
+
+   static struct option longopts[] = {
+      { "hugepages",   no_argument,       NULL, OPT_HUGEPAGES },
+      { "drop-cache",  no_argument,       NULL, OPT_DROP_CACHE },
+      { "cpus",        required_argument, NULL, OPT_CPUS },
+      { "max-buffer-mem", required_argument, NULL, OPT_MAX_BUFFER_MEM },
+      { "journal",     required_argument, NULL, OPT_JOURNAL },
+      { NULL,          0,                 NULL, 0 }
+   };
+
+   memset(defoutdir, '\0', sizeof(defoutdir));
+
+   enable_aesni = Check_CPU_support_AES();
+
+   while ((ch = getopt_long(argc, argv, "b:dj:m:o:qs:vx", longopts, NULL)) != -1)
+   {
+      switch (ch)
+      {
+         case 'b':
+            iosize = parsesize(optarg);
+            if(iosize < READSIZE)
+            {
+               fprintf(stderr, "Invalid I/O size %s, minimum is %d\n", optarg, READSIZE);
+               exit(EXIT_FAILURE);
+            }
+            iosize = (iosize + PBALIGN-1) & ~(size_t)(PBALIGN-1);
+            break;
+         case 'd':
+            if(tracelevel > TRC_DEBUG)
+               tracelevel--;
+            break;
+         case 'j':
+            workers = parsecount(optarg);
+            if(workers < 0)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 'm':
+            metricsfile = optarg;
+            break;
+         case 'o':
+            if(strlen(optarg) >= PATH_MAX-1)
+            {
+               usage();
+               exit(EXIT_FAILURE);
+            }
+            strcpy(defoutdir, optarg);
+            break;
+         case 'q':
+            if(tracelevel < TRC_ERROR)
+               tracelevel++;
+            break;
+         case 's':
+            sockpath = optarg;
+            break;
+         case 'v':
+            fprintf(stderr, "drmdecryptd %s (%s)\n\n", VERSION, STR(REVISION));
+            fprintf(stderr, "Source: http://github.com/decke/drmdecrypt\n");
+            fprintf(stderr, "License: GNU General Public License\n");
+            exit(EXIT_SUCCESS);
+         case 'x':
+            enable_aesni = 0;
+            break;
+         case OPT_HUGEPAGES:
+            arenaflags |= ARENA_HUGEPAGES;
+            break;
+         case OPT_DROP_CACHE:
+            dropcache = 1;
+            break;
+         case OPT_CPUS:
+            cpulist = optarg;
+            break;
+         case OPT_MAX_BUFFER_MEM:
+            membudget = parsesize(optarg);
+            if(membudget == 0)
+            {
+               fprintf(stderr, "Invalid buffer memory size %s\n", optarg);
+               exit(EXIT_FAILURE);
+            }
+            arenaflags |= ARENA_LAZY;
+            break;
+         case OPT_JOURNAL:
+            journalfile = optarg;
+            break;
+         default:
+            usage();
+            exit(EXIT_FAILURE);
+      }
+   }
+
+   if(argc != optind)
+   {
+      usage();
+      exit(EXIT_FAILURE);
+   }
+
+   if(affinity_init(cpulist) != 0)
+   {
+      fprintf(stderr, "Invalid CPU list %s\n", cpulist);
+      exit(EXIT_FAILURE);
+   }
+
+   if(workers == 0)
+      workers = affinity_ncpus();
+#ifdef LOWMEM
+   workers = 1;
+#endif
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if(strlen(sockpath) >= sizeof(addr.sun_path))
+   {
+      fprintf(stderr, "Socket path %s is too long\n", sockpath);
+      exit(EXIT_FAILURE);
+   }
+   strcpy(addr.sun_path, sockpath);
+
+   if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+   {
+      trace(TRC_ERROR, "Cannot create socket: %s", strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+
+   /* a socket left behind by a previous run */
+   unlink(sockpath);
+
+   if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(sock, 16) != 0)
+   {
+      trace(TRC_ERROR, "Cannot listen on %s: %s", sockpath, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+
+   /* accept() returns EINTR on a signal so the loop below can end */
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = sighandler;
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   signal(SIGPIPE, SIG_IGN);
+
+   trace(TRC_INFO, "AES-NI CPU support %s", enable_aesni ? "enabled" : "disabled");
+   trace(TRC_INFO, "Listening on %s with %d workers", sockpath, workers);
+
+   if(journalfile != NULL)
+   {
+      if(journal_open(journalfile) != 0)
+         exit(EXIT_FAILURE);
+      jobs_recover();
+   }
+
+   if((threads = calloc(workers, sizeof(pthread_t))) == NULL)
+      exit(EXIT_FAILURE);
+
+   for(i = 0; i < workers; i++)
+   {
+      if(pthread_create(&threads[i], NULL, daemon_worker, (void *)(size_t)i) != 0)
+      {
+         trace(TRC_ERROR, "Cannot start worker thread");
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+   while(!quit)
+   {
+      if((fd = accept(sock, NULL, NULL)) == -1)
+      {
+         if(errno != EINTR)
+            trace(TRC_ERROR, "accept failed: %s", strerror(errno));
+         continue;
+      }
+
+      if(pthread_create(&tid, &attr, daemon_client, (void *)(size_t)fd) != 0)
+      {
+         trace(TRC_ERROR, "Cannot start client thread");
+         close(fd);
+      }
+   }
+
+   trace(TRC_INFO, "Shutting down, waiting for running jobs");
+
+   close(sock);
+   unlink(sockpath);
+
+   /* running jobs are finished, queued ones dropped */
+   pthread_mutex_lock(&jobs_lock);
+   stopping = 1;
+   pthread_cond_broadcast(&jobs_cond);
+   pthread_mutex_unlock(&jobs_lock);
+
+   for(i = 0; i < workers; i++)
+      pthread_join(threads[i], NULL);
+   free(threads);
+
+   if(metricsfile != NULL && stats_write_prom(metricsfile) != 0)
+      trace(TRC_ERROR, "Cannot write metrics to %s", metricsfile);
+
+   return 0;
+}
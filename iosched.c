@@ -0,0 +1,405 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+#include "iosched.h"
+#include "mem.h"
+#include "trace.h"
+
+int ssdreaders = 0;
+int iosched_elevator = 0;
+
+static struct iodev *devices = NULL;
+static pthread_mutex_t iosched_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Ask sysfs if the disk behind dev spins. Partitions have no queue
+ * directory of their own, the whole disk is one level up. Anything
+ * without a block device (NFS, tmpfs) counts as solid state.
+ */
+static int iosched_rotational(dev_t dev)
+{
+   int rot = 0;
+#ifdef __linux__
+   char path[PATH_MAX];
+   FILE *fp;
+
+   snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational",
+            major(dev), minor(dev));
+   if((fp = fopen(path, "r")) == NULL)
+   {
+      snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational",
+               major(dev), minor(dev));
+      fp = fopen(path, "r");
+   }
+
+   if(fp != NULL)
+   {
+      if(fscanf(fp, "%d", &rot) != 1)
+         rot = 0;
+      fclose(fp);
+   }
+#endif
+
+   return rot;
+}
+
+/*
+ * Read slots of the device fd lives on, registered on first use.
+ * Returns NULL if fd cannot be stat'ed, reads are not limited then.
+ * LOWMEM has a single reader and no devices to allocate.
+ */
+struct iodev *iosched_device(int fd)
+{
+   struct iodev *d;
+   struct stat st;
+
+#ifdef LOWMEM
+   return NULL;
+#endif
+
+   if(fstat(fd, &st) != 0)
+      return NULL;
+
+   pthread_mutex_lock(&iosched_lock);
+
+   for(d = devices; d != NULL; d = d->next)
+   {
+      if(d->dev == (unsigned long long)st.st_dev)
+         break;
+   }
+
+   if(d == NULL && (d = calloc(1, sizeof(*d))) != NULL)
+   {
+      d->dev = st.st_dev;
+      d->rotational = iosched_rotational(st.st_dev);
+      d->slots = d->rotational ? 1 : ssdreaders;
+      d->burst = d->rotational ? IOSCHED_BURST : 0;
+      pthread_cond_init(&d->cond, NULL);
+      d->next = devices;
+      devices = d;
+
+      if(d->slots > 0)
+         trace(TRC_INFO, "device %#llx is %s, %d concurrent readers", d->dev,
+               d->rotational ? "rotational" : "solid state", d->slots);
+      else
+         trace(TRC_INFO, "device %#llx is solid state, readers not limited", d->dev);
+   }
+
+   pthread_mutex_unlock(&iosched_lock);
+
+   return d;
+}
+
+/*
+ * Next waiter to get a slot, see struct iodev
+ */
+static struct iowaiter **iosched_pick(struct iodev *d)
+{
+   struct iowaiter **w, **ahead = NULL, **lowest = NULL;
+
+   if(!iosched_elevator)
+      return &d->waiters;
+
+   for(w = &d->waiters; *w != NULL; w = &(*w)->next)
+   {
+      if((*w)->addr >= d->head && (ahead == NULL || (*w)->addr < (*ahead)->addr))
+         ahead = w;
+      if(lowest == NULL || (*w)->addr < (*lowest)->addr)
+         lowest = w;
+   }
+
+   return ahead != NULL ? ahead : lowest;
+}
+
+/* a reservation that ran out is dropped, called with the lock held */
+static int iosched_reserved(struct iodev *d)
+{
+   struct timespec now;
+
+   if(!d->reserved)
+      return 0;
+
+   clock_gettime(CLOCK_REALTIME, &now);
+   if(now.tv_sec > d->holduntil.tv_sec ||
+      (now.tv_sec == d->holduntil.tv_sec && now.tv_nsec >= d->holduntil.tv_nsec))
+   {
+      d->reserved = 0;
+      d->owner = NULL;
+   }
+
+   return d->reserved;
+}
+
+/* hand free slots to waiters, called with the lock held */
+static void iosched_grant(struct iodev *d)
+{
+   struct iowaiter **pick, *w;
+
+   while(d->busy < d->slots && d->waiters != NULL && !iosched_reserved(d))
+   {
+      pick = iosched_pick(d);
+      w = *pick;
+      *pick = w->next;
+
+      w->granted = 1;
+      d->busy++;
+      d->head = w->addr;
+      d->owner = w->owner;
+      d->left = d->burst;
+   }
+
+   pthread_cond_broadcast(&d->cond);
+}
+
+/*
+ * Wait for a read slot. addr is the physical address the caller reads
+ * next, only used with iosched_elevator. owner identifies the reader
+ * across reads, for its burst.
+ */
+void iodev_acquire(struct iodev *d, const void *owner, unsigned long long addr)
+{
+   struct iowaiter w, **tail;
+
+   if(d->slots == 0)
+      return;
+
+   pthread_mutex_lock(&iosched_lock);
+
+   if(d->busy < d->slots &&
+      (iosched_reserved(d) ? d->owner == owner : d->waiters == NULL))
+   {
+      if(!d->reserved)
+      {
+         d->owner = owner;
+         d->left = d->burst;
+      }
+      d->reserved = 0;
+      d->busy++;
+      d->head = addr;
+      pthread_mutex_unlock(&iosched_lock);
+      return;
+   }
+
+   w.owner = owner;
+   w.addr = addr;
+   w.granted = 0;
+   w.next = NULL;
+   for(tail = &d->waiters; *tail != NULL; tail = &(*tail)->next)
+      ;
+   *tail = &w;
+
+   /* waiters behind a reservation take over when it runs out */
+   while(!w.granted)
+   {
+      if(d->reserved)
+      {
+         pthread_cond_timedwait(&d->cond, &iosched_lock, &d->holduntil);
+         iosched_grant(d);
+      }
+      else
+         pthread_cond_wait(&d->cond, &iosched_lock);
+   }
+
+   pthread_mutex_unlock(&iosched_lock);
+}
+
+/*
+ * Give the slot back after reading bytes. Unless the owner is done
+ * with the file or its burst, the slot stays reserved for it for
+ * IOSCHED_HOLD ms.
+ */
+void iodev_release(struct iodev *d, const void *owner, size_t bytes, int done)
+{
+   if(d->slots == 0)
+      return;
+
+   pthread_mutex_lock(&iosched_lock);
+
+   d->busy--;
+   if(d->owner == owner)
+   {
+      d->left = bytes < d->left ? d->left - bytes : 0;
+      if(!done && d->left > 0)
+      {
+         clock_gettime(CLOCK_REALTIME, &d->holduntil);
+         d->holduntil.tv_nsec += IOSCHED_HOLD * 1000000L;
+         if(d->holduntil.tv_nsec >= 1000000000L)
+         {
+            d->holduntil.tv_sec++;
+            d->holduntil.tv_nsec -= 1000000000L;
+         }
+         d->reserved = 1;
+      }
+      else
+         d->owner = NULL;
+   }
+
+   iosched_grant(d);
+   pthread_mutex_unlock(&iosched_lock);
+}
+
+#ifdef __linux__
+/*
+ * Query up to count extents of fd starting at file offset 0
+ */
+static struct fiemap *iosched_fiemap(int fd, int count)
+{
+   struct fiemap *fm;
+
+   fm = (struct fiemap *)xmalloc(sizeof(*fm) + count * sizeof(struct fiemap_extent));
+   if(fm == NULL)
+      return NULL;
+
+   memset(fm, 0, sizeof(*fm));
+   fm->fm_start = 0;
+   fm->fm_length = FIEMAP_MAX_OFFSET;
+   fm->fm_extent_count = count;
+
+   if(ioctl(fd, FS_IOC_FIEMAP, fm) != 0)
+   {
+      xfree(fm);
+      return NULL;
+   }
+
+   return fm;
+}
+#endif
+
+/*
+ * Extent map of fd, NULL if the filesystem cannot tell. Files with
+ * more than IOSCHED_EXTENTS extents are mapped partly, offsets after
+ * the last mapped extent are assumed to follow it contiguously.
+ */
+struct iomap *iosched_map(int fd)
+{
+#ifdef __linux__
+   struct fiemap *fm;
+   struct iomap *map;
+   unsigned int i;
+
+   if((fm = iosched_fiemap(fd, IOSCHED_EXTENTS)) == NULL)
+      return NULL;
+
+   if(fm->fm_mapped_extents == 0 || (map = (struct iomap *)xmalloc(sizeof(*map))) == NULL)
+   {
+      xfree(fm);
+      return NULL;
+   }
+
+   map->count = 0;
+   for(i=0; i < fm->fm_mapped_extents; i++)
+   {
+      /* delayed allocation and the like have no address yet */
+      if(fm->fm_extents[i].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC))
+         continue;
+
+      map->ext[map->count].logical = fm->fm_extents[i].fe_logical;
+      map->ext[map->count].physical = fm->fm_extents[i].fe_physical;
+      map->ext[map->count].length = fm->fm_extents[i].fe_length;
+      map->count++;
+   }
+
+   xfree(fm);
+
+   if(map->count == 0)
+   {
+      xfree(map);
+      return NULL;
+   }
+
+   return map;
+#else
+   return NULL;
+#endif
+}
+
+/*
+ * Physical address behind a file offset, the offset itself without a map
+ */
+unsigned long long iomap_physical(struct iomap *map, unsigned long long offset)
+{
+   int lo, hi, mid;
+
+   if(map == NULL)
+      return offset;
+
+   /* last extent starting at or before offset */
+   lo = 0;
+   hi = map->count - 1;
+   while(lo < hi)
+   {
+      mid = (lo + hi + 1) / 2;
+      if(map->ext[mid].logical <= offset)
+         lo = mid;
+      else
+         hi = mid - 1;
+   }
+
+   if(offset < map->ext[lo].logical)
+      return map->ext[lo].physical;
+
+   return map->ext[lo].physical + (offset - map->ext[lo].logical);
+}
+
+/*
+ * Device and physical address of the first block of path, for sorting
+ * a batch. Returns 1 if the address is unknown.
+ */
+int iosched_fileaddr(const char *path, unsigned long long *dev, unsigned long long *addr)
+{
+   struct stat st;
+   int fd, ret = 1;
+
+   *dev = 0;
+   *addr = 0;
+
+   if((fd = open(path, O_RDONLY)) == -1)
+      return 1;
+
+   if(fstat(fd, &st) == 0)
+      *dev = st.st_dev;
+
+#ifdef __linux__
+   {
+      struct fiemap *fm;
+
+      if((fm = iosched_fiemap(fd, 1)) != NULL)
+      {
+         if(fm->fm_mapped_extents > 0 &&
+            !(fm->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC)))
+         {
+            *addr = fm->fm_extents[0].fe_physical;
+            ret = 0;
+         }
+         xfree(fm);
+      }
+   }
+#endif
+
+   close(fd);
+
+   return ret;
+}
@@ -0,0 +1,92 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _IOSCHED_H_
+#define _IOSCHED_H_
+
+#include <pthread.h>
+#include <time.h>
+
+#define IOSCHED_BURST  (8*1024*1024)   /* bytes one reader keeps a disk */
+#define IOSCHED_HOLD   5                /* ms the disk waits for it */
+#define IOSCHED_EXTENTS  256            /* extents mapped per file */
+
+/*
+ * Read slots per backing device. Parallel workers reading from the
+ * same rotational disk make it seek between files, so only one of
+ * them may read at a time. A slot is only held for the read() calls
+ * themselves; decrypting and writing happen outside of it, so the
+ * other workers can use the disk meanwhile. Solid state devices allow
+ * ssdreaders concurrent readers (0 means no limit).
+ *
+ * To still stream IOSCHED_BURST bytes of one file before seeking to
+ * the next, the reader of a rotational disk owns a burst: after each
+ * read the slot stays reserved for the owner for up to IOSCHED_HOLD
+ * ms, less than a seek costs. An owner that comes back in time reads
+ * on; one that is slower (a blocked write, a busy CPU) loses the disk
+ * to the next waiter.
+ *
+ * Waiting readers are served in order of arrival, or with iosched_
+ * elevator set in order of the physical address they read next: the
+ * first one at or after the last position, wrapping around at the end
+ * of the disk (C-SCAN).
+ */
+struct iowaiter
+{
+   const void *owner;
+   unsigned long long addr;
+   int granted;
+   struct iowaiter *next;
+};
+
+struct iodev
+{
+   unsigned long long dev;
+   int rotational;
+   int slots;                 /* concurrent readers, 0 unlimited */
+   int busy;
+   size_t burst;              /* bytes to read before giving up the slot */
+   const void *owner;         /* reader of the current burst */
+   size_t left;               /* bytes left in its burst */
+   int reserved;              /* free slot kept for the owner until holduntil */
+   struct timespec holduntil;
+   unsigned long long head;   /* physical address of the last read granted */
+   struct iowaiter *waiters;  /* in order of arrival */
+   pthread_cond_t cond;
+   struct iodev *next;
+};
+
+/*
+ * Extent map of a file from the FIEMAP ioctl, to find the physical
+ * address behind a file offset
+ */
+struct ioextent
+{
+   unsigned long long logical;
+   unsigned long long physical;
+   unsigned long long length;
+};
+
+struct iomap
+{
+   int count;
+   struct ioextent ext[IOSCHED_EXTENTS];
+};
+
+extern int ssdreaders;
+extern int iosched_elevator;
+
+extern struct iodev *iosched_device(int fd);
+extern void iodev_acquire(struct iodev *d, const void *owner, unsigned long long addr);
+extern void iodev_release(struct iodev *d, const void *owner, size_t bytes, int done);
+extern struct iomap *iosched_map(int fd);
+extern unsigned long long iomap_physical(struct iomap *map, unsigned long long offset);
+extern int iosched_fileaddr(const char *path, unsigned long long *dev, unsigned long long *addr);
+
+#endif /* _IOSCHED_H_ */
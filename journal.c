@@ -0,0 +1,385 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _MSC_VER
+#include "w32\w32.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "journal.h"
+#include "trace.h"
+#include "thread.h"
+
+#ifndef O_BINARY
+#define O_BINARY  0
+#endif
+
+#ifdef __APPLE__
+#define fdatasync(fd)  fsync(fd)
+#endif
+
+#define JOURNAL_LINE  (2*PATH_MAX+128)
+
+int journaling = 0;
+
+static int journalfd = -1;
+static struct jentry *buckets[JOURNAL_BUCKETS];
+static struct jentry *entries = NULL;
+static struct jentry **entrytail = &entries;
+
+/* group commit: records up to synced are on disk */
+static unsigned long long written = 0;
+static unsigned long long synced = 0;
+static int syncing = 0;
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journal_cond = PTHREAD_COND_INITIALIZER;
+
+
+static unsigned int journal_bucket(const char *file)
+{
+   unsigned int h = 2166136261u;
+
+   while(*file)
+      h = (h ^ (unsigned char)*file++) * 16777619u;
+
+   return h % JOURNAL_BUCKETS;
+}
+
+struct jentry *journal_lookup(const char *file)
+{
+   struct jentry *e;
+
+   for(e = buckets[journal_bucket(file)]; e != NULL; e = e->next)
+   {
+      if(strcmp(e->file, file) == 0)
+         return e;
+   }
+
+   return NULL;
+}
+
+struct jentry *journal_entries(void)
+{
+   return entries;
+}
+
+/*
+ * Apply one record to the in-memory state. Only used while replaying,
+ * later records are just appended.
+ */
+static int journal_apply(char *line)
+{
+   unsigned long long offset, hash;
+   char *file, *outdir, *p;
+   struct jentry *e;
+   int state, priority, n;
+   unsigned int b;
+   char st;
+
+   if(sscanf(line, "%c\t%llu\t%llx\t%d\t%n", &st, &offset, &hash, &priority, &n) != 4)
+      return 1;
+   state = (unsigned char)st;
+
+   file = line + n;
+   if((p = strchr(file, '\t')) == NULL)
+      return 1;
+   *p = '\0';
+   outdir = p + 1;
+
+   if((e = journal_lookup(file)) == NULL)
+   {
+      if((e = calloc(1, sizeof(*e))) == NULL || (e->file = strdup(file)) == NULL)
+         return 1;
+      b = journal_bucket(file);
+      e->next = buckets[b];
+      buckets[b] = e;
+      *entrytail = e;
+      entrytail = &e->order;
+   }
+
+   if(e->outdir == NULL || strcmp(e->outdir, outdir) != 0)
+   {
+      free(e->outdir);
+      e->outdir = strdup(outdir);
+   }
+
+   /* a new submission starts over, everything else keeps the last
+      checkpoint so a failed or interrupted job can resume from it */
+   if(state == JR_QUEUED)
+   {
+      e->offset = 0;
+      e->hash = JHASH_BASIS;
+   }
+   else if(state == JR_RUNNING || state == JR_CHECKPOINT || state == JR_DONE)
+   {
+      e->offset = offset;
+      e->hash = hash;
+   }
+   e->state = state;
+   e->priority = priority;
+
+   return 0;
+}
+
+static int journal_format(char *line, int state, const char *file, const char *outdir,
+   int priority, unsigned long long offset, unsigned long long hash)
+{
+   int len;
+
+   len = snprintf(line, JOURNAL_LINE, "%c\t%llu\t%016llx\t%d\t%s\t%s\n",
+      state, offset, hash, priority, file, outdir != NULL ? outdir : "");
+
+   return len > 0 && len < JOURNAL_LINE ? len : -1;
+}
+
+/*
+ * Replay the journal at path and rewrite it with one record per file,
+ * then keep it open for appending.
+ */
+int journal_open(const char *path)
+{
+   char line[JOURNAL_LINE];
+   char tmppath[PATH_MAX];
+   struct jentry *e;
+   FILE *fp;
+   size_t len;
+   int fd, n, bad = 0;
+
+   if((fp = fopen(path, "r")) != NULL)
+   {
+      while(fgets(line, sizeof(line), fp) != NULL)
+      {
+         len = strlen(line);
+
+         /* torn write of a crashed process */
+         if(len == 0 || line[len-1] != '\n')
+         {
+            bad++;
+            continue;
+         }
+         line[len-1] = '\0';
+
+         if(journal_apply(line) != 0)
+            bad++;
+      }
+      fclose(fp);
+   }
+   else if(errno != ENOENT)
+   {
+      trace(TRC_ERROR, "Cannot read journal %s: %s", path, strerror(errno));
+      return 1;
+   }
+
+   if(bad > 0)
+      trace(TRC_WARN, "ignored %d broken records in journal %s", bad, path);
+
+   /* compact, the rename replaces the old journal atomically */
+   if(snprintf(tmppath, sizeof(tmppath), "%s.tmp", path) >= (int)sizeof(tmppath))
+      return 1;
+
+   if((fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644)) == -1)
+   {
+      trace(TRC_ERROR, "Cannot write journal %s: %s", tmppath, strerror(errno));
+      return 1;
+   }
+
+   for(e = entries; e != NULL; e = e->order)
+   {
+      n = journal_format(line, e->state, e->file, e->outdir, e->priority, e->offset, e->hash);
+      if(n < 0 || write(fd, line, n) != n)
+      {
+         trace(TRC_ERROR, "Cannot write journal %s", tmppath);
+         close(fd);
+         unlink(tmppath);
+         return 1;
+      }
+   }
+
+   if(fdatasync(fd) != 0 || close(fd) != 0)
+   {
+      trace(TRC_ERROR, "Cannot write journal %s: %s", tmppath, strerror(errno));
+      unlink(tmppath);
+      return 1;
+   }
+
+#ifdef _MSC_VER
+   unlink(path);
+#endif
+   if(rename(tmppath, path) != 0)
+   {
+      trace(TRC_ERROR, "Cannot replace journal %s: %s", path, strerror(errno));
+      unlink(tmppath);
+      return 1;
+   }
+
+   if((journalfd = open(path, O_WRONLY | O_APPEND | O_BINARY)) == -1)
+   {
+      trace(TRC_ERROR, "Cannot open journal %s: %s", path, strerror(errno));
+      return 1;
+   }
+
+   journaling = 1;
+
+   return 0;
+}
+
+/*
+ * Append a record. Queued, done, failed and canceled records are on
+ * disk when this returns: the first caller that needs a sync does one
+ * fdatasync for everything written so far while later callers wait
+ * for it instead of issuing their own.
+ */
+int journal_record(int state, const char *file, const char *outdir,
+   int priority, unsigned long long offset, unsigned long long hash)
+{
+   char line[JOURNAL_LINE];
+   unsigned long long seq, target;
+   int len, ret = 0;
+
+   if(!journaling)
+      return 0;
+
+   if((len = journal_format(line, state, file, outdir, priority, offset, hash)) < 0)
+   {
+      trace(TRC_WARN, "journal record for %s too long", file);
+      return 1;
+   }
+
+   pthread_mutex_lock(&journal_lock);
+
+   if(write(journalfd, line, len) != len)
+   {
+      pthread_mutex_unlock(&journal_lock);
+      trace(TRC_ERROR, "Cannot write journal: %s", strerror(errno));
+      return 1;
+   }
+   seq = ++written;
+
+   if(state == JR_RUNNING || state == JR_CHECKPOINT)
+   {
+      pthread_mutex_unlock(&journal_lock);
+      return 0;
+   }
+
+   while(synced < seq)
+   {
+      if(syncing)
+      {
+         pthread_cond_wait(&journal_cond, &journal_lock);
+         continue;
+      }
+
+      syncing = 1;
+      target = written;
+      pthread_mutex_unlock(&journal_lock);
+
+      if(fdatasync(journalfd) != 0)
+      {
+         trace(TRC_ERROR, "Cannot sync journal: %s", strerror(errno));
+         ret = 1;
+      }
+
+      pthread_mutex_lock(&journal_lock);
+      syncing = 0;
+      if(ret == 0)
+         synced = target;
+      pthread_cond_broadcast(&journal_cond);
+
+      if(ret != 0)
+         break;
+   }
+
+   pthread_mutex_unlock(&journal_lock);
+
+   return ret;
+}
+
+/*
+ * Make an output file durable before it is journaled as checkpointed
+ * or done.
+ */
+int journal_syncfile(int fd)
+{
+   if(fdatasync(fd) != 0)
+   {
+      trace(TRC_ERROR, "Cannot sync output: %s", strerror(errno));
+      return 1;
+   }
+
+   return 0;
+}
+
+void jhash_init(struct jhash *jh, unsigned long long h)
+{
+   jh->h = h;
+   jh->n = 0;
+}
+
+static unsigned long long jhash_le64(const unsigned char *p)
+{
+   return (unsigned long long)p[0] | (unsigned long long)p[1] << 8 |
+          (unsigned long long)p[2] << 16 | (unsigned long long)p[3] << 24 |
+          (unsigned long long)p[4] << 32 | (unsigned long long)p[5] << 40 |
+          (unsigned long long)p[6] << 48 | (unsigned long long)p[7] << 56;
+}
+
+void jhash_update(struct jhash *jh, const void *buf, size_t len)
+{
+   const unsigned char *p = buf;
+   unsigned long long h = jh->h;
+   size_t n = jh->n & 7;
+
+   /* complete a word left over from the last call */
+   if(n > 0)
+   {
+      while(n < 8 && len > 0)
+      {
+         jh->tail[n++] = *p++;
+         len--;
+      }
+      if(n == 8)
+      {
+         h = (h ^ jhash_le64(jh->tail)) * JHASH_PRIME;
+         n = 0;
+      }
+      jh->n = (int)n;
+   }
+
+   for(; len >= 8; p += 8, len -= 8)
+      h = (h ^ jhash_le64(p)) * JHASH_PRIME;
+
+   /* less than a word left, and only if the tail was completed */
+   if(len > 0)
+   {
+      memcpy(jh->tail, p, len);
+      jh->n = (int)len;
+   }
+
+   jh->h = h;
+}
+
+unsigned long long jhash_final(struct jhash *jh)
+{
+   unsigned long long h = jh->h;
+   int i;
+
+   for(i=0; i < jh->n; i++)
+      h = (h ^ jh->tail[i]) * JHASH_PRIME;
+
+   return h;
+}
@@ -0,0 +1,81 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stddef.h>
+
+/*
+ * Append-only journal of job state changes, one line per record:
+ *
+ *   state \t offset \t hash \t priority \t file \t outdir \n
+ *
+ * A checkpoint record says the output up to offset is on disk and
+ * hash is the output hash state there, so a job can be resumed from
+ * it. Records that must survive a crash (queued, done, failed,
+ * canceled) are fsynced before journal_record() returns; concurrent
+ * callers share one fdatasync (group commit). A torn last line is
+ * ignored on replay.
+ */
+#ifndef JOURNAL_CHECKPOINT
+#define JOURNAL_CHECKPOINT  (64*1024*1024)   /* input bytes between checkpoints */
+#endif
+#define JOURNAL_BUCKETS     4096
+
+enum {
+   JR_QUEUED = 'Q',
+   JR_RUNNING = 'R',
+   JR_CHECKPOINT = 'C',
+   JR_DONE = 'D',
+   JR_FAILED = 'F',
+   JR_CANCELED = 'X'
+};
+
+/* last state of a file from the replayed journal */
+struct jentry
+{
+   char *file;
+   char *outdir;
+   int state;
+   int priority;
+   unsigned long long offset;
+   unsigned long long hash;
+   struct jentry *next;       /* hash chain */
+   struct jentry *order;      /* in journal order */
+};
+
+/*
+ * 64 bit FNV-1a over the output as little endian 64 bit words, the
+ * bytes of a last partial word one by one.
+ */
+#define JHASH_BASIS  0xcbf29ce484222325ULL
+#define JHASH_PRIME  0x100000001b3ULL
+
+struct jhash
+{
+   unsigned long long h;
+   unsigned char tail[8];
+   int n;
+};
+
+extern int journaling;
+
+extern int journal_open(const char *path);
+extern struct jentry *journal_lookup(const char *file);
+extern struct jentry *journal_entries(void);
+extern int journal_record(int state, const char *file, const char *outdir,
+   int priority, unsigned long long offset, unsigned long long hash);
+extern int journal_syncfile(int fd);
+
+extern void jhash_init(struct jhash *jh, unsigned long long h);
+extern void jhash_update(struct jhash *jh, const void *buf, size_t len);
+extern unsigned long long jhash_final(struct jhash *jh);
+
+#endif /* _JOURNAL_H_ */
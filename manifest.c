@@ -0,0 +1,339 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "manifest.h"
+#include "trace.h"
+
+/* "-" reads from stdin */
+int manifest_open(struct manifest *m, const char *path)
+{
+   m->path = path;
+   m->line = 0;
+
+   if(strcmp(path, "-") == 0)
+      m->fp = stdin;
+   else if((m->fp = fopen(path, "r")) == NULL)
+   {
+      trace(TRC_ERROR, "Cannot open manifest %s: %s", path, strerror(errno));
+      return 1;
+   }
+
+   return 0;
+}
+
+void manifest_close(struct manifest *m)
+{
+   if(m->fp != NULL && m->fp != stdin)
+      fclose(m->fp);
+   m->fp = NULL;
+}
+
+static int parsekey(unsigned char *key, const char *str)
+{
+   unsigned int b;
+   int i;
+
+   if(strlen(str) != 32)
+      return 1;
+
+   for(i=0; i < 16; i++)
+   {
+      if(!isxdigit((unsigned char)str[2*i]) || !isxdigit((unsigned char)str[2*i+1]) ||
+         sscanf(str + 2*i, "%2x", &b) != 1)
+         return 1;
+      key[i] = (unsigned char)b;
+   }
+
+   return 0;
+}
+
+static int addpid(struct tsfilter *f, long pid)
+{
+   if(pid < 0 || pid > 0x1fff || f->npids >= FILTER_PIDS)
+      return 1;
+
+   f->pids[f->npids++] = (unsigned short)pid;
+
+   return 0;
+}
+
+/* "256,257,0x101" */
+static int parsepids(struct tsfilter *f, const char *str)
+{
+   char *end;
+
+   while(*str != '\0')
+   {
+      if(addpid(f, strtol(str, &end, 0)) != 0 || end == str)
+         return 1;
+      str = end;
+      if(*str == ',')
+         str++;
+      else if(*str != '\0')
+         return 1;
+   }
+
+   return 0;
+}
+
+/* "60-120", "60-" or "-120" */
+static int parsetimes(struct tsfilter *f, const char *str)
+{
+   char *end;
+
+   if(*str != '-')
+   {
+      f->start = strtod(str, &end);
+      if(end == str)
+         return 1;
+      str = end;
+   }
+   if(*str++ != '-')
+      return 1;
+   if(*str != '\0')
+   {
+      f->end = strtod(str, &end);
+      if(*end != '\0' || f->end <= f->start)
+         return 1;
+   }
+
+   return 0;
+}
+
+static int parsetsv(struct mentry *e, char *line)
+{
+   char *field[5];
+   int i, n = 0;
+
+   field[n++] = line;
+   while(n < 5 && (line = strchr(line, '\t')) != NULL)
+   {
+      *line++ = '\0';
+      field[n++] = line;
+   }
+   for(i=n; i < 5; i++)
+      field[i] = "";
+
+   if(strlen(field[0]) >= PATH_MAX || strlen(field[1]) >= PATH_MAX)
+      return 1;
+   strcpy(e->file, field[0]);
+   strcpy(e->outfile, field[1]);
+
+   if(*field[2] != '\0')
+   {
+      if(parsekey(e->key, field[2]) != 0)
+         return 1;
+      e->haskey = 1;
+   }
+   if(*field[3] != '\0')
+   {
+      if(parsepids(&e->filter, field[3]) != 0)
+         return 1;
+      e->hasfilter = 1;
+   }
+   if(*field[4] != '\0')
+   {
+      if(parsetimes(&e->filter, field[4]) != 0)
+         return 1;
+      e->hasfilter = 1;
+   }
+
+   return 0;
+}
+
+static char *skipws(char *p)
+{
+   while(isspace((unsigned char)*p))
+      p++;
+   return p;
+}
+
+/*
+ * JSON string at p, unescaped into dst. Only \u escapes below 0x80
+ * are supported, which is enough for the keys and for paths.
+ */
+static char *jsonstr(char *p, char *dst, size_t size)
+{
+   unsigned int u;
+   size_t n = 0;
+
+   if(*p++ != '"')
+      return NULL;
+
+   while(*p != '"')
+   {
+      if(*p == '\0' || n+1 >= size)
+         return NULL;
+
+      if(*p == '\\')
+      {
+         p++;
+         switch(*p)
+         {
+            case 'n': dst[n++] = '\n'; break;
+            case 't': dst[n++] = '\t'; break;
+            case 'r': dst[n++] = '\r'; break;
+            case 'b': dst[n++] = '\b'; break;
+            case 'f': dst[n++] = '\f'; break;
+            case 'u':
+               /* exactly four hex digits, the && stops at a NUL */
+               if(!isxdigit((unsigned char)p[1]) || !isxdigit((unsigned char)p[2]) ||
+                  !isxdigit((unsigned char)p[3]) || !isxdigit((unsigned char)p[4]) ||
+                  sscanf(p+1, "%4x", &u) != 1 || u == 0 || u >= 0x80)
+                  return NULL;
+               dst[n++] = (char)u;
+               p += 4;
+               break;
+            case '"': case '\\': case '/': dst[n++] = *p; break;
+            default: return NULL;
+         }
+         p++;
+      }
+      else
+         dst[n++] = *p++;
+   }
+   dst[n] = '\0';
+
+   return p+1;
+}
+
+static char *jsonnum(char *p, double *val)
+{
+   char *end;
+
+   *val = strtod(p, &end);
+
+   return end == p ? NULL : end;
+}
+
+static int parsejson(struct mentry *e, char *p)
+{
+   char name[16];
+   char str[PATH_MAX];
+   double val;
+
+   p = skipws(p+1);
+   while(*p != '}')
+   {
+      if((p = jsonstr(p, name, sizeof(name))) == NULL)
+         return 1;
+      p = skipws(p);
+      if(*p++ != ':')
+         return 1;
+      p = skipws(p);
+
+      if(strcmp(name, "pids") == 0)
+      {
+         if(*p++ != '[')
+            return 1;
+         p = skipws(p);
+         while(*p != ']')
+         {
+            if((p = jsonnum(p, &val)) == NULL || addpid(&e->filter, (long)val) != 0)
+               return 1;
+            p = skipws(p);
+            if(*p == ',')
+               p = skipws(p+1);
+            else if(*p != ']')
+               return 1;
+         }
+         p++;
+         e->hasfilter = 1;
+      }
+      else if(strcmp(name, "start") == 0 || strcmp(name, "end") == 0)
+      {
+         if((p = jsonnum(p, &val)) == NULL || val < 0)
+            return 1;
+         if(name[0] == 's')
+            e->filter.start = val;
+         else
+            e->filter.end = val;
+         e->hasfilter = 1;
+      }
+      else
+      {
+         if((p = jsonstr(p, str, sizeof(str))) == NULL)
+            return 1;
+
+         if(strcmp(name, "file") == 0)
+            strcpy(e->file, str);
+         else if(strcmp(name, "out") == 0)
+            strcpy(e->outfile, str);
+         else if(strcmp(name, "key") == 0)
+         {
+            if(parsekey(e->key, str) != 0)
+               return 1;
+            e->haskey = 1;
+         }
+         else
+            return 1;
+      }
+
+      p = skipws(p);
+      if(*p == ',')
+         p = skipws(p+1);
+      else if(*p != '}')
+         return 1;
+   }
+
+   if(e->filter.end > 0 && e->filter.end <= e->filter.start)
+      return 1;
+
+   return 0;
+}
+
+/*
+ * Read the next entry, 0 at the end of the manifest. Broken lines are
+ * reported and skipped.
+ */
+int manifest_next(struct manifest *m, struct mentry *e)
+{
+   char line[MANIFEST_LINE];
+   char *p;
+   size_t len;
+   int ch, ret;
+
+   while(fgets(line, sizeof(line), m->fp) != NULL)
+   {
+      m->line++;
+      len = strlen(line);
+
+      if(len > 0 && line[len-1] != '\n' && !feof(m->fp))
+      {
+         trace(TRC_WARN, "%s:%lu: line too long, skipped", m->path, m->line);
+         while((ch = fgetc(m->fp)) != EOF && ch != '\n')
+            ;
+         continue;
+      }
+      line[strcspn(line, "\r\n")] = '\0';
+
+      p = skipws(line);
+      if(*p == '\0' || *p == '#')
+         continue;
+
+      memset(e, 0, sizeof(*e));
+      ret = *p == '{' ? parsejson(e, p) : parsetsv(e, line);
+
+      if(ret != 0 || e->file[0] == '\0')
+      {
+         trace(TRC_WARN, "%s:%lu: invalid entry, skipped", m->path, m->line);
+         continue;
+      }
+
+      return 1;
+   }
+
+   return 0;
+}
@@ -0,0 +1,62 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _MANIFEST_H_
+#define _MANIFEST_H_
+
+#include <stdio.h>
+#include <limits.h>
+
+#include "decrypt.h"
+
+/*
+ * Job manifest for --jobs, read one entry at a time so its size does
+ * not matter. Every line is either tab separated
+ *
+ *   file [\t outfile [\t key [\t pids [\t start-end]]]]
+ *
+ * or a JSON object
+ *
+ *   {"file":"a.srf","out":"a.ts","key":"00112233...","pids":[256,257],
+ *    "start":60,"end":120}
+ *
+ * Empty fields take the defaults. key is the 16 byte DRM key in hex,
+ * pids a comma separated list and start/end are seconds into the
+ * recording. Empty lines and lines starting with # are skipped.
+ */
+#define MANIFEST_LINE  (3*PATH_MAX+1024)
+
+struct mentry
+{
+   char file[PATH_MAX];
+   char outfile[PATH_MAX];
+   char outdir[PATH_MAX];     /* only set by -r, see walk.h */
+   int paired;                /* -r found these next to file: */
+   char mdbfile[PATH_MAX];
+   char inffile[PATH_MAX];    /* empty without .inf */
+   unsigned char key[16];
+   int haskey;
+   int hasfilter;
+   struct tsfilter filter;
+   struct decrypt_meta meta;  /* read ahead by batch.h */
+   unsigned long long lost;   /* claim taken over, see claim.h */
+};
+
+struct manifest
+{
+   FILE *fp;
+   const char *path;
+   unsigned long line;
+};
+
+extern int manifest_open(struct manifest *m, const char *path);
+extern int manifest_next(struct manifest *m, struct mentry *e);
+extern void manifest_close(struct manifest *m);
+
+#endif /* _MANIFEST_H_ */
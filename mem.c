@@ -0,0 +1,240 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#if defined(HAVE__ALIGNED_MALLOC)
+#include <malloc.h>
+#endif
+#ifndef _MSC_VER
+#include <sys/resource.h>
+#include <sys/mman.h>
+#endif
+
+#include "mem.h"
+#include "arena.h"
+
+struct memstats memstats;
+pthread_mutex_t memstats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+size_t membudget = 0;
+
+static THREAD_LOCAL struct arena *mem_arena;
+
+static size_t budgetused = 0;
+static int budgetholders = 0;
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t budget_cond = PTHREAD_COND_INITIALIZER;
+
+/* Wrapper functions for malloc and free with memory alignment */
+#if defined(HAVE_ALIGNED_ALLOC) /* aligned_alloc is defined by C11 */
+# define aligned_malloc_wrapper aligned_alloc
+# define aligned_free_wrapper free
+#elif defined(HAVE_POSIX_MEMALIGN) /* posix_memalign is defined by POSIX */
+static void* aligned_malloc_wrapper(size_t alignment, size_t size)
+{
+    void* tmp = NULL;
+    int err = posix_memalign(&tmp, alignment, size);
+    if (err != 0) {
+        /* posix_memalign does NOT set errno on failure; the error is returned */
+        errno = err;
+        return NULL;
+    }
+    return tmp;
+}
+# define aligned_free_wrapper free
+#elif defined(HAVE__ALIGNED_MALLOC) /* _aligned_malloc is available on Windows */
+static void* aligned_malloc_wrapper(size_t alignment, size_t size)
+{
+    /* NB: _aligned_malloc takes its args in the opposite order from aligned_alloc */
+    return _aligned_malloc(size, alignment);
+}
+# define aligned_free_wrapper _aligned_free
+#else
+# error "No function to allocate/free aligned memory is available."
+#endif
+
+/*
+ * Every block carries a header in front of the returned pointer with
+ * the start of the real allocation and the requested size. The header
+ * takes a full alignment unit so the user pointer stays aligned.
+ */
+struct memhdr
+{
+   void *base;
+   size_t size;
+};
+
+#define MEM_MINALIGN  16
+
+void *xmemalign(size_t alignment, size_t size)
+{
+   struct memhdr *hdr;
+   char *base;
+
+   if(mem_arena != NULL && (base = arena_alloc(mem_arena, alignment, size)) != NULL)
+      return base;
+
+#ifdef LOWMEM
+   /* the fixed arena is all there is */
+   return NULL;
+#endif
+
+   if(alignment < MEM_MINALIGN)
+      alignment = MEM_MINALIGN;
+   while(alignment < sizeof(struct memhdr))
+      alignment <<= 1;
+
+   base = aligned_malloc_wrapper(alignment, alignment + size);
+   if(base == NULL)
+      return NULL;
+
+   hdr = (struct memhdr *)(base + alignment) - 1;
+   hdr->base = base;
+   hdr->size = size;
+
+   pthread_mutex_lock(&memstats_lock);
+   memstats.allocated += size;
+   memstats.allocs++;
+   memstats.inuse += size;
+   if(memstats.inuse > memstats.peak)
+      memstats.peak = memstats.inuse;
+   pthread_mutex_unlock(&memstats_lock);
+
+   return base + alignment;
+}
+
+void *xmalloc(size_t size)
+{
+   return xmemalign(MEM_MINALIGN, size);
+}
+
+void xfree(void *ptr)
+{
+   struct memhdr *hdr;
+
+   if(ptr == NULL)
+      return;
+
+   /* arena memory is released all at once by arena_reset() */
+   if(mem_arena != NULL && arena_owns(mem_arena, ptr))
+      return;
+
+   hdr = (struct memhdr *)ptr - 1;
+
+   pthread_mutex_lock(&memstats_lock);
+   memstats.frees++;
+   memstats.inuse -= hdr->size;
+   pthread_mutex_unlock(&memstats_lock);
+
+   aligned_free_wrapper(hdr->base);
+}
+
+void mem_use_arena(struct arena *a)
+{
+   mem_arena = a;
+}
+
+void mem_snapshot(struct memstats *ms)
+{
+   pthread_mutex_lock(&memstats_lock);
+   *ms = memstats;
+   pthread_mutex_unlock(&memstats_lock);
+}
+
+/*
+ * Reserve up to want bytes of the buffer budget, at least min. Returns
+ * the bytes granted, want itself without a budget.
+ */
+size_t mem_reserve(size_t want, size_t min)
+{
+   size_t grant;
+
+   if(membudget == 0)
+      return want;
+
+   pthread_mutex_lock(&budget_lock);
+
+   for(;;)
+   {
+      grant = membudget / (budgetholders + 1);
+      if(grant > want)
+         grant = want;
+      if(budgetused < membudget && grant > membudget - budgetused)
+         grant = membudget - budgetused;
+
+      if(budgetused < membudget && grant >= min)
+         break;
+
+      /* a single file always gets its minimum, even over budget */
+      if(budgetholders == 0)
+      {
+         grant = min;
+         break;
+      }
+
+      pthread_cond_wait(&budget_cond, &budget_lock);
+   }
+
+   budgetused += grant;
+   budgetholders++;
+
+   pthread_mutex_unlock(&budget_lock);
+
+   return grant;
+}
+
+void mem_release(size_t size)
+{
+   if(membudget == 0)
+      return;
+
+   pthread_mutex_lock(&budget_lock);
+   budgetused -= size;
+   budgetholders--;
+   pthread_cond_broadcast(&budget_cond);
+   pthread_mutex_unlock(&budget_lock);
+}
+
+/*
+ * Give the pages of a buffer back to the kernel while keeping the
+ * mapping, so memory that is no longer reserved is no longer resident.
+ */
+void mem_discard(void *ptr, size_t size)
+{
+#if defined(MADV_DONTNEED) && !defined(LOWMEM)
+   size_t page = 4096;
+   char *start = (char *)(((size_t)ptr + page-1) & ~(page-1));
+   char *end = (char *)(((size_t)ptr + size) & ~(page-1));
+
+   if(end > start)
+      madvise(start, end - start, MADV_DONTNEED);
+#endif
+}
+
+/*
+ * Peak resident set size of the process in bytes, 0 if unknown
+ */
+unsigned long long mem_peak_rss(void)
+{
+#ifdef _MSC_VER
+   return 0;
+#else
+   struct rusage ru;
+
+   if(getrusage(RUSAGE_SELF, &ru) != 0)
+      return 0;
+
+#ifdef __APPLE__
+   return ru.ru_maxrss;
+#else
+   return (unsigned long long)ru.ru_maxrss * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,57 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stddef.h>
+
+#include "thread.h"
+
+/*
+ * Accounting allocator. All buffers and key schedules go through
+ * xmalloc()/xmemalign() so we can prove memory stays flat over long
+ * batches. With an arena set by mem_use_arena() requests are served
+ * from it first and never touch the heap. The arena is per thread,
+ * the counters are shared and updated under memstats_lock.
+ */
+struct memstats
+{
+   unsigned long long allocated;   /* bytes ever allocated */
+   unsigned long long allocs;      /* number of allocations */
+   unsigned long long frees;
+   unsigned long long inuse;       /* bytes currently allocated */
+   unsigned long long peak;        /* high watermark of inuse */
+};
+
+extern struct memstats memstats;
+extern pthread_mutex_t memstats_lock;
+
+/*
+ * Budget for the I/O buffers of all files decrypted at once, 0 for no
+ * limit. Each file reserves its buffer with mem_reserve() and gets at
+ * most a fair share, the budget divided by the files holding part of
+ * it. If not even min bytes are left the caller waits until another
+ * file releases its reservation.
+ */
+extern size_t membudget;
+
+struct arena;
+
+extern void *xmalloc(size_t size);
+extern void *xmemalign(size_t alignment, size_t size);
+extern void xfree(void *ptr);
+extern void mem_use_arena(struct arena *a);
+extern void mem_snapshot(struct memstats *ms);
+extern size_t mem_reserve(size_t want, size_t min);
+extern void mem_release(size_t size);
+extern void mem_discard(void *ptr, size_t size);
+extern unsigned long long mem_peak_rss(void);
+
+#endif /* _MEM_H_ */
@@ -0,0 +1,130 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+/*
+ * Generate a synthetic recording (.srf, .mdb, .inf) for benchmarks.
+ * The packet mix is deterministic: 1 in 5 packets is clear, 1 in 7
+ * has an adaptation field and every 50000th packet is followed by a
+ * few junk bytes to force a resync.
+ *
+ * Usage: gencorpus basepath packets
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../aes.h"
+
+#define PACKETSIZE  188
+
+static unsigned int seed = 0x2f6e2b1;
+
+static unsigned char rnd(void)
+{
+   /* xorshift32, same stream on every platform */
+   seed ^= seed << 13;
+   seed ^= seed >> 17;
+   seed ^= seed << 5;
+   return seed & 0xff;
+}
+
+static int writefile(const char *base, const char *suffix, const void *data, size_t len)
+{
+   char path[1024];
+   FILE *fp;
+
+   snprintf(path, sizeof(path), "%s.%s", base, suffix);
+   if((fp = fopen(path, "wb")) == NULL || fwrite(data, 1, len, fp) != len)
+   {
+      fprintf(stderr, "cannot write %s\n", path);
+      return 1;
+   }
+   fclose(fp);
+
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   static const char *channel = "Bench", *title = "Corpus";
+   unsigned char key[BLOCK_SIZE], mdb[64], inf[0x200], pkt[PACKETSIZE];
+   char path[1024];
+   block_state state;
+   long n, packets;
+   int i, off, scrambled;
+   FILE *fp;
+
+   if(argc != 3 || (packets = atol(argv[2])) < 1)
+   {
+      fprintf(stderr, "Usage: gencorpus basepath packets\n");
+      return 1;
+   }
+
+   /* key is stored with the words byte swapped, see readdrmkey() */
+   for(i=0; i < BLOCK_SIZE; i++)
+      key[i] = rnd();
+   memset(mdb, 0, sizeof(mdb));
+   for(i=0; i < BLOCK_SIZE; i++)
+      mdb[8+i] = key[(i&0xc)+(3-(i&3))];
+
+   memset(inf, 0, sizeof(inf));
+   for(i=0; channel[i]; i++)
+      inf[1+2*i] = channel[i];
+   for(i=0; title[i]; i++)
+      inf[0x101+2*i] = title[i];
+
+   if(writefile(argv[1], "mdb", mdb, sizeof(mdb)) || writefile(argv[1], "inf", inf, sizeof(inf)))
+      return 1;
+
+   memset(&state, 0, sizeof(state));
+   state.rounds = 10;
+   block_init_aes(&state, key, BLOCK_SIZE);
+
+   snprintf(path, sizeof(path), "%s.srf", argv[1]);
+   if((fp = fopen(path, "wb")) == NULL)
+   {
+      fprintf(stderr, "cannot write %s\n", path);
+      return 1;
+   }
+
+   for(n=0; n < packets; n++)
+   {
+      for(i=0; i < PACKETSIZE; i++)
+         pkt[i] = rnd();
+
+      scrambled = (n % 5 != 0);
+      pkt[0] = 0x47;
+      pkt[1] = 0x01;
+      pkt[2] = 0x00;
+      pkt[3] = (scrambled ? ((n & 1) ? 0xC0 : 0x80) : 0x00) | 0x10 | (n & 0x0f);
+      off = 4;
+
+      if(n % 7 == 0)
+      {
+         pkt[3] |= 0x20;
+         pkt[4] = rnd() % 20;
+         off += pkt[4] + 1;
+      }
+
+      if(scrambled)
+         for(i=off; i+BLOCK_SIZE <= PACKETSIZE; i+=BLOCK_SIZE)
+            block_encrypt_aes(&state, pkt+i, pkt+i);
+
+      if(fwrite(pkt, 1, PACKETSIZE, fp) != PACKETSIZE)
+         return 1;
+
+      if(n % 50000 == 49999)
+         fwrite("\x11\x11\x11\x11\x11", 1, 5, fp);
+   }
+
+   fclose(fp);
+
+   return 0;
+}
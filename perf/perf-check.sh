@@ -0,0 +1,135 @@
+#!/bin/sh
+#
+# perf-check.sh -- compare decrypt throughput against a stored baseline
+#
+# Decrypts a generated corpus with every engine, keeps the best of
+# PERF_RUNS runs and fails if MB/s dropped or cycles/byte rose by more
+# than PERF_TOLERANCE percent compared to perf/baseline.json. Run with
+# PERF_UPDATE=1 to write the measured values as the new baseline.
+#
+# Cycles/byte is the stable half of the check. Without performance
+# counters on this host or in the baseline only MB/s is compared and
+# a warning says so. The corpus must have the packet count the
+# baseline was recorded with, otherwise nothing is compared.
+#
+# Usage: make perf-check [PERF_TOLERANCE=15] [PERF_RUNS=5] [PERF_PACKETS=200000]
+#
+
+BIN=${BIN:-./drmdecrypt}
+GEN=${GEN:-perf/gencorpus}
+BASELINE=${BASELINE:-perf/baseline.json}
+TOLERANCE=${PERF_TOLERANCE:-15}
+RUNS=${PERF_RUNS:-5}
+PACKETS=${PERF_PACKETS:-200000}
+
+# engine name and drmdecrypt flags to select it
+ENGINES="aesni: aes:-x"
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT INT TERM
+
+if [ "$PERF_UPDATE" != "1" ] && [ -f "$BASELINE" ]; then
+   bpackets=$(sed -n 's/.*"packets" *: *\([0-9][0-9]*\).*/\1/p' "$BASELINE")
+   if [ "$bpackets" != "$PACKETS" ]; then
+      echo "$BASELINE was recorded with ${bpackets:-unknown} packets, not $PACKETS"
+      echo "run with PERF_PACKETS=${bpackets:-N} or record a new baseline"
+      exit 1
+   fi
+fi
+
+"$GEN" "$tmp/corpus" "$PACKETS" || exit 1
+
+# value of key in the line of the given engine, empty if missing or null
+baseline()
+{
+   sed -n "s/.*\"$1\" *:.*\"$2\" *: *\([0-9.][0-9.]*\).*/\1/p" "$BASELINE" 2>/dev/null
+}
+
+status=0
+nocycles=0
+results=""
+
+printf "%-8s %10s %10s %12s %12s  %s\n" engine MB/s base cycles/byte base result
+
+for e in $ENGINES
+do
+   name=${e%%:*}
+   flags=$(echo "${e#*:}" | tr ',' ' ')
+
+   case "$name" in
+   aesni*)
+      if ! grep -qw aes /proc/cpuinfo 2>/dev/null; then
+         printf "%-8s skipped, no AES-NI\n" "$name"
+         continue
+      fi
+      ;;
+   esac
+
+   mbps=0
+   cpb=""
+   run=0
+   while [ $run -lt "$RUNS" ]
+   do
+      run=$((run+1))
+      rm -f "$tmp"/*.ts
+
+      out=$("$BIN" -q $flags --perf-counters --progress=json --progress-fd=1 \
+                -o "$tmp/" "$tmp/corpus.srf" 2>"$tmp/stderr") || {
+         echo "$name: drmdecrypt failed"; cat "$tmp/stderr"; exit 1; }
+
+      m=$(echo "$out" | sed -n 's/.*"mbps_avg":\([0-9.]*\).*/\1/p' | tail -1)
+      c=$(sed -n 's/^perf .*: \([0-9.]*\) cycles\/byte.*/\1/p' "$tmp/stderr")
+
+      mbps=$(awk -v a="$mbps" -v b="$m" 'BEGIN { print (b > a) ? b : a }')
+      if [ -n "$c" ]; then
+         cpb=$(awk -v a="$cpb" -v b="$c" 'BEGIN { print (a == "" || b < a) ? b : a }')
+      fi
+   done
+
+   bmbps=$(baseline "$name" mbps)
+   bcpb=$(baseline "$name" cycles_per_byte)
+
+   result=$(awk -v m="$mbps" -v bm="$bmbps" -v c="$cpb" -v bc="$bcpb" -v t="$TOLERANCE" 'BEGIN {
+      r = "ok"
+      if(bm != "" && m < bm * (1 - t/100)) r = "REGRESSION"
+      if(bc != "" && c != "" && c > bc * (1 + t/100)) r = "REGRESSION"
+      if(r == "ok" && (c == "" || bc == "")) r = "ok (MB/s only)"
+      if(bm == "") r = "no baseline"
+      print r }')
+
+   case "$result" in
+   REGRESSION) status=1 ;;
+   *MB/s*) nocycles=1 ;;
+   esac
+
+   printf "%-8s %10s %10s %12s %12s  %s\n" "$name" "$mbps" "${bmbps:--}" \
+      "${cpb:--}" "${bcpb:--}" "$result"
+
+   results="$results    \"$name\": { \"mbps\": $mbps, \"cycles_per_byte\": ${cpb:-null} },
+"
+done
+
+if [ "$PERF_UPDATE" = "1" ]; then
+   if printf "%s" "$results" | grep -q null; then
+      echo "warning: cycles/byte not measured, the baseline only has MB/s"
+   fi
+   {
+      echo "{"
+      echo "  \"packets\": $PACKETS,"
+      echo "  \"engines\": {"
+      printf "%s" "$results" | sed '$ s/,$//'
+      echo "  }"
+      echo "}"
+   } > "$BASELINE"
+   echo "baseline written to $BASELINE"
+   exit 0
+fi
+
+if [ $nocycles -ne 0 ]; then
+   echo "warning: cycles/byte missing here or in the baseline, compared MB/s only"
+   echo "(perf_event_open needs kernel.perf_event_paranoid <= 2 and a PMU)"
+fi
+if [ $status -ne 0 ]; then
+   echo "performance regression beyond ${TOLERANCE}%"
+fi
+exit $status
@@ -0,0 +1,170 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "perfcnt.h"
+
+#ifdef __linux__
+
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+
+static const struct {
+   unsigned int type;
+   unsigned long long config;
+} pcevents[PC_MAX] = {
+   { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+   { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+   { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                         (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+   { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+   { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+/*
+ * Open all counters as one group led by the cycle counter so starting
+ * and stopping costs a single ioctl each. Counters the CPU does not
+ * support are left out of the group.
+ */
+int perfcnt_open(struct perfcnt *pc)
+{
+   struct perf_event_attr attr;
+   int i;
+
+   for(i=0; i < PC_MAX; i++)
+   {
+      pc->fd[i] = -1;
+      pc->val[i] = 0;
+   }
+
+   for(i=0; i < PC_MAX; i++)
+   {
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = pcevents[i].type;
+      attr.config = pcevents[i].config;
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.disabled = (i == PC_CYCLES);
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, pc->fd[PC_CYCLES], 0);
+
+      /* without the group leader there is nothing to measure */
+      if(pc->fd[PC_CYCLES] == -1)
+         return 1;
+   }
+
+   return 0;
+}
+
+void perfcnt_close(struct perfcnt *pc)
+{
+   int i;
+
+   for(i=PC_MAX-1; i >= 0; i--)
+   {
+      if(pc->fd[i] != -1)
+         close(pc->fd[i]);
+      pc->fd[i] = -1;
+   }
+}
+
+void perfcnt_reset(struct perfcnt *pc)
+{
+   if(pc->fd[PC_CYCLES] != -1)
+      ioctl(pc->fd[PC_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+void perfcnt_start(struct perfcnt *pc)
+{
+   if(pc->fd[PC_CYCLES] != -1)
+      ioctl(pc->fd[PC_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perfcnt_stop(struct perfcnt *pc)
+{
+   unsigned long long buf[1+PC_MAX];
+   ssize_t len;
+   int i, n;
+
+   if(pc->fd[PC_CYCLES] == -1)
+      return;
+
+   ioctl(pc->fd[PC_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+   /* group values come in the order the counters were added */
+   len = read(pc->fd[PC_CYCLES], buf, sizeof(buf));
+   if(len < (ssize_t)sizeof(buf[0]))
+      return;
+
+   for(i=0, n=1; i < PC_MAX && n <= (int)buf[0]; i++)
+   {
+      if(pc->fd[i] != -1)
+         pc->val[i] = buf[n++];
+   }
+}
+
+#else
+
+int perfcnt_open(struct perfcnt *pc)
+{
+   int i;
+
+   for(i=0; i < PC_MAX; i++)
+   {
+      pc->fd[i] = -1;
+      pc->val[i] = 0;
+   }
+
+   return 1;
+}
+
+void perfcnt_close(struct perfcnt *pc) { }
+void perfcnt_reset(struct perfcnt *pc) { }
+void perfcnt_start(struct perfcnt *pc) { }
+void perfcnt_stop(struct perfcnt *pc) { }
+
+#endif /* __linux__ */
+
+void perfcnt_report(struct perfcnt *pc, const char *file,
+   unsigned long long bytes, unsigned long long packets)
+{
+   char line[256];
+   double cycles = pc->val[PC_CYCLES];
+   int n;
+
+   if(pc->fd[PC_CYCLES] == -1 || bytes == 0)
+      return;
+
+   n = snprintf(line, sizeof(line), "%.3f cycles/byte", cycles / bytes);
+
+   if(pc->fd[PC_INSTRUCTIONS] != -1 && cycles > 0)
+      n += snprintf(line+n, sizeof(line)-n, ", IPC %.2f", pc->val[PC_INSTRUCTIONS] / cycles);
+
+   if(packets > 0)
+   {
+      if(pc->fd[PC_L1D_MISSES] != -1)
+         n += snprintf(line+n, sizeof(line)-n, ", L1D misses/packet %.3f",
+                       (double)pc->val[PC_L1D_MISSES] / packets);
+      if(pc->fd[PC_LLC_MISSES] != -1)
+         n += snprintf(line+n, sizeof(line)-n, ", LLC misses/packet %.3f",
+                       (double)pc->val[PC_LLC_MISSES] / packets);
+      if(pc->fd[PC_BRANCH_MISSES] != -1)
+         n += snprintf(line+n, sizeof(line)-n, ", branch misses/packet %.3f",
+                       (double)pc->val[PC_BRANCH_MISSES] / packets);
+   }
+
+   fprintf(stderr, "perf %s: %s\n", file, line);
+}
@@ -0,0 +1,42 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _PERFCNT_H_
+#define _PERFCNT_H_
+
+/*
+ * Hardware performance counters around the decrypt stage using
+ * perf_event_open(2). Only available on Linux, elsewhere perfcnt_open()
+ * always fails.
+ */
+
+enum {
+   PC_CYCLES = 0,
+   PC_INSTRUCTIONS,
+   PC_L1D_MISSES,
+   PC_LLC_MISSES,
+   PC_BRANCH_MISSES,
+   PC_MAX
+};
+
+struct perfcnt
+{
+   int fd[PC_MAX];          /* -1 if the counter is not available */
+   unsigned long long val[PC_MAX];
+};
+
+extern int perfcnt_open(struct perfcnt *pc);
+extern void perfcnt_close(struct perfcnt *pc);
+extern void perfcnt_reset(struct perfcnt *pc);
+extern void perfcnt_start(struct perfcnt *pc);
+extern void perfcnt_stop(struct perfcnt *pc);
+extern void perfcnt_report(struct perfcnt *pc, const char *file,
+   unsigned long long bytes, unsigned long long packets);
+
+#endif /* _PERFCNT_H_ */
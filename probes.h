@@ -0,0 +1,44 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/*
+ * USDT static probes (provider "drmdecrypt"). A disabled probe is a
+ * single nop, so these stay in release builds. List them with
+ *
+ *    bpftrace -l 'usdt:./drmdecrypt:*'
+ *
+ * Probe            | arguments
+ * -----------------+----------------------------------------
+ * file__open       | srffile, filesize
+ * key__loaded      | mdbfile, aesni
+ * sync__found      | file offset
+ * resync           | file offset
+ * chunk__read      | file offset, bytes
+ * chunk__decrypted | file offset, bytes
+ * chunk__written   | file offset, bytes
+ */
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PROBE1(N, A)       DTRACE_PROBE1(drmdecrypt, N, A)
+#define PROBE2(N, A, B)    DTRACE_PROBE2(drmdecrypt, N, A, B)
+
+#else
+
+#define PROBE1(N, A)       do { (void)(A); } while(0)
+#define PROBE2(N, A, B)    do { (void)(A); (void)(B); } while(0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* _PROBES_H_ */
@@ -0,0 +1,115 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#ifdef _MSC_VER
+#include <io.h>
+#include "w32\w32.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "progress.h"
+#include "stats.h"
+
+int progressfd = -1;
+
+
+/*
+ * Escape str for use inside a JSON string, truncated to fit size
+ */
+char *progress_jsonstr(char *dst, size_t size, const char *str)
+{
+   const char *s;
+   size_t n = 0;
+
+   for(s = str; *s && n < size-7; s++)
+   {
+      if(*s == '"' || *s == '\\')
+      {
+         dst[n++] = '\\';
+         dst[n++] = *s;
+      }
+      else if((unsigned char)*s < 0x20)
+         n += sprintf(dst+n, "\\u%04x", (unsigned char)*s);
+      else
+         dst[n++] = *s;
+   }
+   dst[n] = '\0';
+
+   return dst;
+}
+
+/*
+ * Emit one newline delimited JSON record. Rates are in MB/s
+ * (10^6 bytes), eta in seconds or -1 while unknown.
+ */
+static void progress_emit(struct progress *pg, const char *state,
+   unsigned long long done, unsigned long long resyncs, double now)
+{
+   char line[2*PATH_MAX+256];
+   char name[2*PATH_MAX];
+   double rate = 0, avg = 0, eta = -1;
+   int len;
+
+   progress_jsonstr(name, sizeof(name), pg->file);
+
+   if(now > pg->last)
+      rate = (done - pg->lastbytes) / (now - pg->last) / 1e6;
+   if(now > pg->start)
+      avg = done / (now - pg->start) / 1e6;
+   if(avg > 0 && pg->total >= done)
+      eta = (pg->total - done) / (avg * 1e6);
+
+   len = snprintf(line, sizeof(line),
+      "{\"file\":\"%s\",\"state\":\"%s\",\"bytes_done\":%llu,\"bytes_total\":%llu,"
+      "\"mbps\":%.2f,\"mbps_avg\":%.2f,\"eta\":%.1f,\"resyncs\":%llu}\n",
+      name, state, done, pg->total, rate, avg, eta, resyncs);
+
+   if(len > 0 && (size_t)len < sizeof(line))
+   {
+      if(write(progressfd, line, len) != len)
+         progressfd = -1;
+   }
+
+   pg->last = now;
+   pg->lastbytes = done;
+}
+
+void progress_begin(struct progress *pg, const char *file, unsigned long long total)
+{
+   memset(pg, 0, sizeof(*pg));
+   pg->file = file;
+   pg->total = total;
+   pg->start = pg->last = stats_now();
+}
+
+void progress_update(struct progress *pg, unsigned long long done, unsigned long long resyncs)
+{
+   double now;
+
+   if(progressfd < 0)
+      return;
+
+   now = stats_now();
+   if(now - pg->last < PROGRESS_INTERVAL)
+      return;
+
+   progress_emit(pg, "running", done, resyncs, now);
+}
+
+void progress_end(struct progress *pg, unsigned long long done, unsigned long long resyncs)
+{
+   if(progressfd < 0)
+      return;
+
+   progress_emit(pg, "done", done, resyncs, stats_now());
+}
@@ -0,0 +1,34 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _PROGRESS_H_
+#define _PROGRESS_H_
+
+#include <stddef.h>
+
+#define PROGRESS_INTERVAL  0.5   /* minimum seconds between two records */
+
+struct progress
+{
+   const char *file;
+   unsigned long long total;
+   unsigned long long lastbytes;
+   double start;
+   double last;
+};
+
+/* file descriptor for --progress=json output, -1 if disabled */
+extern int progressfd;
+
+extern char *progress_jsonstr(char *dst, size_t size, const char *str);
+extern void progress_begin(struct progress *pg, const char *file, unsigned long long total);
+extern void progress_update(struct progress *pg, unsigned long long done, unsigned long long resyncs);
+extern void progress_end(struct progress *pg, unsigned long long done, unsigned long long resyncs);
+
+#endif /* _PROGRESS_H_ */
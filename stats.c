@@ -0,0 +1,344 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#ifdef _MSC_VER
+#include <windows.h>
+#include "w32\w32.h"
+#endif
+
+#include "stats.h"
+#include "mem.h"
+
+THREAD_LOCAL struct stats stats;
+struct stats stats_total;
+
+/* part of stats already merged into stats_total */
+static THREAD_LOCAL struct stats flushed;
+static THREAD_LOCAL double lastflush;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct {
+   const char *metric;
+   const char *label;
+   const char *help;
+} lat_names[LAT_MAX] = {
+   { "stage_seconds",   "stage=\"read\"",    "Latency of one call per pipeline stage." },
+   { "stage_seconds",   "stage=\"decrypt\"", NULL },
+   { "stage_seconds",   "stage=\"write\"",   NULL },
+   { "chunk_seconds",   NULL,                "Time from reading a chunk until it is written." },
+   { "syscall_seconds", "call=\"read\"",     "Latency of single read() and write() calls." },
+   { "syscall_seconds", "call=\"write\"",    NULL }
+};
+
+static double lastwrite;
+
+
+double stats_now(void)
+{
+#ifdef _MSC_VER
+   LARGE_INTEGER freq, cnt;
+   QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&cnt);
+   return (double)cnt.QuadPart / (double)freq.QuadPart;
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static int hist_index(unsigned long long v)
+{
+   int msb = 0, shift;
+
+   if(v < HIST_SUB)
+      return (int)v;
+
+   if(v >> HIST_MAXMSB)
+      v = (1ULL << (HIST_MAXMSB+1)) - 1;
+
+   while(v >> (msb+1))
+      msb++;
+
+   shift = msb - HIST_SUB_BITS;
+   return (shift+1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+/* first value that no longer falls into bucket i */
+static unsigned long long hist_upper(int i)
+{
+   int shift;
+
+   if(i < HIST_SUB)
+      return i+1;
+
+   shift = i / HIST_SUB - 1;
+   return (unsigned long long)(HIST_SUB + i % HIST_SUB + 1) << shift;
+}
+
+/*
+ * Account the time since start to a latency histogram
+ */
+void stats_latency(int hist, double start)
+{
+   struct histogram *h = &stats.lat[hist];
+   double d = stats_now() - start;
+   unsigned long long ns = d > 0 ? (unsigned long long)(d * 1e9) : 0;
+
+   h->bucket[hist_index(ns)]++;
+   h->count++;
+   h->sum += d;
+   if(ns > h->max)
+      h->max = ns;
+}
+
+/*
+ * Value in seconds below which the fraction q of all samples lie
+ */
+double hist_percentile(struct histogram *h, double q)
+{
+   unsigned long long cum = 0, want;
+   unsigned long long v;
+   int i;
+
+   if(h->count == 0)
+      return 0;
+
+   want = (unsigned long long)(q * h->count + 0.5);
+   if(want < 1)
+      want = 1;
+
+   for(i=0; i < HIST_BUCKETS; i++)
+   {
+      cum += h->bucket[i];
+      if(cum >= want)
+         break;
+   }
+
+   v = hist_upper(i < HIST_BUCKETS ? i : HIST_BUCKETS-1);
+   if(v > h->max)
+      v = h->max;
+
+   return v / 1e9;
+}
+
+void stats_report_latency(FILE *fp)
+{
+   static const char *names[LAT_MAX] = {
+      "read", "decrypt", "write", "chunk", "read()", "write()"
+   };
+   struct histogram *h;
+   int i;
+
+   fprintf(fp, "latency (us)       count      p50      p90      p99    p99.9      max\n");
+   for(i=0; i < LAT_MAX; i++)
+   {
+      h = &stats_total.lat[i];
+      fprintf(fp, "%-10s %13llu %8.1f %8.1f %8.1f %8.1f %8.1f\n", names[i], h->count,
+              hist_percentile(h, 0.5) * 1e6, hist_percentile(h, 0.9) * 1e6,
+              hist_percentile(h, 0.99) * 1e6, hist_percentile(h, 0.999) * 1e6,
+              h->max / 1e3);
+   }
+}
+
+static void prom_counter(FILE *fp, const char *name, const char *help, unsigned long long val)
+{
+   fprintf(fp, "# HELP drmdecrypt_%s %s\n", name, help);
+   fprintf(fp, "# TYPE drmdecrypt_%s counter\n", name);
+   fprintf(fp, "drmdecrypt_%s %llu\n", name, val);
+}
+
+static void prom_gauge(FILE *fp, const char *name, const char *help, unsigned long long val)
+{
+   fprintf(fp, "# HELP drmdecrypt_%s %s\n", name, help);
+   fprintf(fp, "# TYPE drmdecrypt_%s gauge\n", name);
+   fprintf(fp, "drmdecrypt_%s %llu\n", name, val);
+}
+
+/*
+ * Prometheus buckets are taken at every other power of two of the
+ * nanosecond histogram, 2^10, 2^12, ... so a factor of 4 apart, where
+ * the fine buckets line up exactly.
+ */
+static void prom_histogram(FILE *fp, int hist)
+{
+   struct histogram *h = &stats_total.lat[hist];
+   const char *metric = lat_names[hist].metric;
+   const char *label = lat_names[hist].label;
+   unsigned long long cum = 0;
+   int i, msb;
+
+   if(lat_names[hist].help != NULL)
+   {
+      fprintf(fp, "# HELP drmdecrypt_%s %s\n", metric, lat_names[hist].help);
+      fprintf(fp, "# TYPE drmdecrypt_%s histogram\n", metric);
+   }
+
+   for(i=0, msb=10; msb <= HIST_MAXMSB; msb += 2)
+   {
+      for(; i < HIST_BUCKETS && hist_upper(i) <= (1ULL << msb); i++)
+         cum += h->bucket[i];
+
+      fprintf(fp, "drmdecrypt_%s_bucket{%s%sle=\"%.9g\"} %llu\n", metric,
+              label ? label : "", label ? "," : "", (1ULL << msb) / 1e9, cum);
+   }
+
+   fprintf(fp, "drmdecrypt_%s_bucket{%s%sle=\"+Inf\"} %llu\n", metric,
+           label ? label : "", label ? "," : "", h->count);
+   fprintf(fp, "drmdecrypt_%s_sum%s%s%s %.9f\n", metric,
+           label ? "{" : "", label ? label : "", label ? "}" : "", h->sum);
+   fprintf(fp, "drmdecrypt_%s_count%s%s%s %llu\n", metric,
+           label ? "{" : "", label ? label : "", label ? "}" : "", h->count);
+}
+
+/*
+ * Write all metrics in Prometheus text exposition format. The file is
+ * written to a temporary name first and renamed so the node_exporter
+ * textfile collector never sees a partial file.
+ */
+int stats_write_prom(const char *path)
+{
+   char tmpfile[PATH_MAX];
+   struct memstats mem;
+   FILE *fp;
+   int s;
+
+   snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", path);
+
+   mem_snapshot(&mem);
+   pthread_mutex_lock(&stats_lock);
+
+   if((fp = fopen(tmpfile, "w")) == NULL)
+   {
+      pthread_mutex_unlock(&stats_lock);
+      return 1;
+   }
+
+   prom_counter(fp, "bytes_read_total", "Bytes read from input files.", stats_total.bytes_read);
+   prom_counter(fp, "bytes_written_total", "Bytes written to output files.", stats_total.bytes_written);
+   prom_counter(fp, "packets_decrypted_total", "Transport stream packets decrypted.", stats_total.packets);
+   prom_counter(fp, "resyncs_total", "Lost packet sync and searched for it again.", stats_total.resyncs);
+   prom_counter(fp, "files_done_total", "Files successfully decrypted.", stats_total.files_done);
+   prom_counter(fp, "files_failed_total", "Files that failed to decrypt.", stats_total.files_failed);
+   prom_gauge(fp, "queue_depth", "Files waiting to be processed.", stats_total.queue_depth);
+   prom_counter(fp, "alloc_bytes_total", "Bytes allocated for buffers and keys.", mem.allocated);
+   prom_counter(fp, "allocs_total", "Allocations for buffers and keys.", mem.allocs);
+   prom_gauge(fp, "alloc_inuse_bytes", "Bytes currently allocated for buffers and keys.", mem.inuse);
+   prom_gauge(fp, "alloc_peak_bytes", "High watermark of allocated bytes.", mem.peak);
+   prom_gauge(fp, "peak_rss_bytes", "Peak resident set size of the process.", mem_peak_rss());
+
+   for(s=0; s < LAT_MAX; s++)
+      prom_histogram(fp, s);
+
+   if(fclose(fp) != 0)
+   {
+      remove(tmpfile);
+      pthread_mutex_unlock(&stats_lock);
+      return 1;
+   }
+
+#ifdef _MSC_VER
+   remove(path);
+#endif
+   if(rename(tmpfile, path) != 0)
+   {
+      remove(tmpfile);
+      pthread_mutex_unlock(&stats_lock);
+      return 1;
+   }
+
+   lastwrite = stats_now();
+   pthread_mutex_unlock(&stats_lock);
+
+   return 0;
+}
+
+/*
+ * Rewrite the metrics file if METRICS_INTERVAL has passed
+ */
+void stats_tick(const char *path)
+{
+   double now = stats_now();
+
+   if(now - lastflush >= STATS_FLUSH)
+   {
+      stats_flush();
+      lastflush = now;
+   }
+
+   if(path != NULL && now - lastwrite >= METRICS_INTERVAL)
+      stats_write_prom(path);
+}
+
+/*
+ * Merge what the calling thread counted since its last flush into
+ * stats_total. The thread local counters keep running so callers can
+ * still take deltas of them.
+ */
+void stats_flush(void)
+{
+   struct histogram *h, *f, *t;
+   int i, b;
+
+   pthread_mutex_lock(&stats_lock);
+
+   stats_total.bytes_read += stats.bytes_read - flushed.bytes_read;
+   stats_total.bytes_written += stats.bytes_written - flushed.bytes_written;
+   stats_total.packets += stats.packets - flushed.packets;
+   stats_total.resyncs += stats.resyncs - flushed.resyncs;
+   stats_total.files_done += stats.files_done - flushed.files_done;
+   stats_total.files_failed += stats.files_failed - flushed.files_failed;
+
+   for(i=0; i < LAT_MAX; i++)
+   {
+      h = &stats.lat[i];
+      f = &flushed.lat[i];
+      t = &stats_total.lat[i];
+
+      if(h->count == f->count)
+         continue;
+
+      for(b=0; b < HIST_BUCKETS; b++)
+         t->bucket[b] += h->bucket[b] - f->bucket[b];
+      t->count += h->count - f->count;
+      t->sum += h->sum - f->sum;
+      if(h->max > t->max)
+         t->max = h->max;
+   }
+
+   pthread_mutex_unlock(&stats_lock);
+
+   memcpy(&flushed, &stats, sizeof(flushed));
+}
+
+/*
+ * Consistent copy of stats_total
+ */
+void stats_read(struct stats *s)
+{
+   pthread_mutex_lock(&stats_lock);
+   memcpy(s, &stats_total, sizeof(*s));
+   pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Files waiting to be processed are counted by the batch, not per
+ * worker
+ */
+void stats_queue(long delta)
+{
+   pthread_mutex_lock(&stats_lock);
+   stats_total.queue_depth += delta;
+   pthread_mutex_unlock(&stats_lock);
+}
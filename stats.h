@@ -0,0 +1,77 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+
+#include "thread.h"
+
+#define METRICS_INTERVAL  10.0   /* seconds between metrics file updates */
+#define STATS_FLUSH       1.0    /* seconds between merging worker counters */
+
+enum {
+   LAT_READ = 0,     /* pipeline stages */
+   LAT_DECRYPT,
+   LAT_WRITE,
+   LAT_CHUNK,        /* chunk read until chunk written */
+   LAT_SYSREAD,      /* single read() call */
+   LAT_SYSWRITE,     /* single write() call */
+   LAT_MAX
+};
+
+/*
+ * Log-linear latency histogram in nanoseconds like HdrHistogram: every
+ * power of two range is split into HIST_SUB linear buckets which gives
+ * about 6% relative precision from 1ns up to 2^HIST_MAXMSB ns (~18min).
+ */
+#define HIST_SUB_BITS  4
+#define HIST_SUB       (1 << HIST_SUB_BITS)
+#define HIST_MAXMSB    40
+#define HIST_BUCKETS   ((HIST_MAXMSB - HIST_SUB_BITS + 2) * HIST_SUB)
+
+struct histogram
+{
+   unsigned long long bucket[HIST_BUCKETS];
+   unsigned long long count;
+   unsigned long long max;
+   double sum;                /* seconds */
+};
+
+struct stats
+{
+   unsigned long long bytes_read;
+   unsigned long long bytes_written;
+   unsigned long long packets;
+   unsigned long long resyncs;
+   unsigned long long files_done;
+   unsigned long long files_failed;
+   unsigned long long queue_depth;
+   struct histogram lat[LAT_MAX];
+};
+
+/*
+ * Every worker counts into its own thread local stats which are merged
+ * into stats_total by stats_flush(). Reports only use stats_total.
+ */
+extern THREAD_LOCAL struct stats stats;
+extern struct stats stats_total;
+
+extern double stats_now(void);
+extern void stats_latency(int hist, double start);
+extern double hist_percentile(struct histogram *h, double q);
+extern void stats_report_latency(FILE *fp);
+extern int stats_write_prom(const char *path);
+extern void stats_tick(const char *path);
+extern void stats_flush(void);
+extern void stats_read(struct stats *s);
+extern void stats_queue(long delta);
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,36 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+/*
+ * Batch workers are POSIX threads (pthreads-win32 on Windows). State
+ * that belongs to the file a worker is decrypting, like the key
+ * schedule, the buffer arena and the hot statistics counters, is
+ * thread local so the decode loop needs no locking.
+ */
+#include <pthread.h>
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL  __declspec(thread)
+#else
+#define THREAD_LOCAL  __thread
+#endif
+
+/* counters written by one thread and read by others, no ordering */
+#ifdef _MSC_VER
+#define ATOMIC_STORE(p, v)  (*(volatile unsigned long long *)(p) = (v))
+#define ATOMIC_LOAD(p)      (*(volatile unsigned long long *)(p))
+#else
+#define ATOMIC_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define ATOMIC_LOAD(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#endif
+
+#endif /* _THREAD_H_ */
@@ -0,0 +1,108 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include <string.h>
+#include <time.h>
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+#include "throttle.h"
+#include "stats.h"
+#include "trace.h"
+
+struct throttle rdthrottle = { 0, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+struct throttle wrthrottle = { 0, 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static void throttle_sleep(double seconds)
+{
+#ifdef _MSC_VER
+   Sleep((DWORD)(seconds * 1000));
+#else
+   struct timespec ts;
+
+   ts.tv_sec = (time_t)seconds;
+   ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+   nanosleep(&ts, NULL);
+#endif
+}
+
+/*
+ * Limit to mbps (10^6 bytes per second), 0 for no limit. target is
+ * the latency in seconds the adaptive mode aims for, 0 to disable it.
+ */
+void throttle_init(struct throttle *t, double mbps, double target)
+{
+   t->rate = t->maxrate = mbps * 1e6;
+   t->tokens = t->rate * THROTTLE_BURST;
+   t->last = t->adjusted = stats_now();
+   t->target = t->rate > 0 ? target : 0;
+   t->latency = 0;
+}
+
+void throttle_wait(struct throttle *t, size_t bytes)
+{
+   double now, debt;
+
+   if(t->maxrate <= 0)
+      return;
+
+   pthread_mutex_lock(&t->lock);
+
+   now = stats_now();
+   t->tokens += (now - t->last) * t->rate;
+   if(t->tokens > t->rate * THROTTLE_BURST)
+      t->tokens = t->rate * THROTTLE_BURST;
+   t->last = now;
+
+   t->tokens -= bytes;
+   debt = t->tokens < 0 ? -t->tokens / t->rate : 0;
+
+   pthread_mutex_unlock(&t->lock);
+
+   if(debt > 0)
+      throttle_sleep(debt);
+}
+
+/*
+ * Feed the latency of one throttled call to the adaptive mode
+ */
+void throttle_latency(struct throttle *t, double seconds)
+{
+   double now, rate;
+
+   if(t->target <= 0)
+      return;
+
+   pthread_mutex_lock(&t->lock);
+
+   t->latency = t->latency > 0 ? 0.9 * t->latency + 0.1 * seconds : seconds;
+
+   now = stats_now();
+   if(now - t->adjusted >= THROTTLE_ADJUST)
+   {
+      if(t->latency > t->target)
+         rate = t->rate * 2 / 3;
+      else
+         rate = t->rate + t->maxrate / 20;
+
+      if(rate < t->maxrate * THROTTLE_MINRATE)
+         rate = t->maxrate * THROTTLE_MINRATE;
+      if(rate > t->maxrate)
+         rate = t->maxrate;
+
+      if(rate != t->rate)
+         trace(TRC_DEBUG, "throttle %.1f MB/s, latency %.3f ms", rate / 1e6, t->latency * 1e3);
+
+      t->rate = rate;
+      t->adjusted = now;
+   }
+
+   pthread_mutex_unlock(&t->lock);
+}
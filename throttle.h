@@ -0,0 +1,50 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _THROTTLE_H_
+#define _THROTTLE_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define THROTTLE_BURST    0.05   /* seconds of traffic allowed at once */
+#define THROTTLE_ADJUST   0.1    /* seconds between adaptive rate changes */
+#define THROTTLE_MINRATE  0.05   /* adaptive rate never drops below this share */
+
+/*
+ * Token bucket shared by all workers, rate in bytes per second and 0
+ * for no limit. A caller takes its bytes right away, possibly going
+ * into debt, and sleeps until the debt is paid off. Parallel workers
+ * get the rate between them that way without a queue.
+ *
+ * With a target latency the rate adapts between THROTTLE_MINRATE of
+ * maxrate and maxrate: it is cut by a third when the average latency
+ * of the throttled calls exceeds the target and raised by a twentieth
+ * of maxrate when it is below (AIMD), at most every THROTTLE_ADJUST.
+ */
+struct throttle
+{
+   double rate;
+   double maxrate;
+   double tokens;
+   double last;               /* time tokens were last added */
+   double target;             /* latency target in seconds, 0 fixed rate */
+   double latency;            /* moving average of call latency */
+   double adjusted;           /* time of the last rate change */
+   pthread_mutex_t lock;
+};
+
+extern struct throttle rdthrottle;
+extern struct throttle wrthrottle;
+
+extern void throttle_init(struct throttle *t, double mbps, double target);
+extern void throttle_wait(struct throttle *t, size_t bytes);
+extern void throttle_latency(struct throttle *t, double seconds);
+
+#endif /* _THROTTLE_H_ */
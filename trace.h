@@ -7,22 +7,37 @@
  * of the GPL v2 license.  See the LICENSE file for details.
  */
 
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
 enum {
    TRC_DEBUG = 0,
-   TRC_INFO,   
+   TRC_INFO,
    TRC_WARN,
    TRC_ERROR
 };
 
-static int tracelevel = TRC_WARN;
+/*
+ * Lowest level that is compiled in at all. Calls below this level are
+ * constant-folded away so release builds pay nothing for TRC_DEBUG
+ * calls in the packet loop. Set with -DTRACE_MINLEVEL=TRC_INFO.
+ */
+#ifndef TRACE_MINLEVEL
+#define TRACE_MINLEVEL TRC_DEBUG
+#endif
+
+extern int tracelevel;
 
 #define trace(L, M, ...) \
-   if(L >= tracelevel) { \
-      if (tracelevel == 0) { \
-         fprintf(stderr, "%s %s:%d: " M "\n", L == 0 ? "DEBUG" : L == 1 ? "INFO" : L == 2 ? "WARN" : "ERROR", __FILE__, __LINE__, ##__VA_ARGS__); \
-      } \
-      else { \
-         fprintf(stderr, "%s " M "\n", L == 0 ? "DEBUG" : L == 1 ? "INFO" : L == 2 ? "WARN" : "ERROR", ##__VA_ARGS__); \
+   do { \
+      if(L >= TRACE_MINLEVEL && L >= tracelevel) { \
+         if (tracelevel == 0) { \
+            fprintf(stderr, "%s %s:%d: " M "\n", L == 0 ? "DEBUG" : L == 1 ? "INFO" : L == 2 ? "WARN" : "ERROR", __FILE__, __LINE__, ##__VA_ARGS__); \
+         } \
+         else { \
+            fprintf(stderr, "%s " M "\n", L == 0 ? "DEBUG" : L == 1 ? "INFO" : L == 2 ? "WARN" : "ERROR", ##__VA_ARGS__); \
+         } \
       } \
-   }
+   } while(0)
 
+#endif /* _TRACE_H_ */
@@ -0,0 +1,92 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#include "tracering.h"
+
+#ifdef ENABLE_TRACERING
+
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+struct trrecord
+{
+   _Atomic unsigned long long seq;
+   unsigned long long ts;
+   unsigned long long a;
+   unsigned long long b;
+   unsigned int event;
+};
+
+static struct trrecord ring[TRRING_SIZE];
+static _Atomic unsigned long long head;
+
+static const char *trnames[TR_MAX] = {
+   "open", "sync", "resync", "read", "packet", "write"
+};
+
+static inline unsigned long long trclock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+void trring_record(unsigned int event, unsigned long long a, unsigned long long b)
+{
+   unsigned long long n;
+   struct trrecord *r;
+
+   n = atomic_fetch_add_explicit(&head, 1, memory_order_relaxed);
+   r = &ring[n & (TRRING_SIZE-1)];
+
+   r->ts = trclock();
+   r->a = a;
+   r->b = b;
+   r->event = event;
+
+   /* publish last so the dumper can skip torn records */
+   atomic_store_explicit(&r->seq, n+1, memory_order_release);
+}
+
+void trring_dump(FILE *fp)
+{
+   unsigned long long n, first, end, start = 0;
+   struct trrecord *r;
+
+   end = atomic_load_explicit(&head, memory_order_acquire);
+   first = end > TRRING_SIZE ? end - TRRING_SIZE : 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+   fprintf(fp, "# %llu events, %llu dropped, time in TSC ticks\n", end, first);
+#else
+   fprintf(fp, "# %llu events, %llu dropped, time in ns\n", end, first);
+#endif
+
+   for(n = first; n < end; n++)
+   {
+      r = &ring[n & (TRRING_SIZE-1)];
+      if(atomic_load_explicit(&r->seq, memory_order_acquire) != n+1)
+         continue;
+
+      if(start == 0)
+         start = r->ts;
+
+      fprintf(fp, "%12llu %-8s %llu %llu\n", r->ts - start,
+              r->event < TR_MAX ? trnames[r->event] : "?", r->a, r->b);
+   }
+}
+
+#endif /* ENABLE_TRACERING */
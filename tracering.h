@@ -0,0 +1,48 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _TRACERING_H_
+#define _TRACERING_H_
+
+#include <stdio.h>
+
+/*
+ * Binary ring buffer tracer. Recording an event stores a timestamp and
+ * two integer arguments into a fixed size ring without locking or
+ * formatting; text is only produced by trring_dump(). Compiled in with
+ * TRACERING=1, otherwise trring() expands to nothing.
+ */
+
+#define TRRING_SIZE  65536   /* records, must be a power of two */
+
+enum {
+   TR_FILE_OPEN = 0,   /* a = filesize */
+   TR_SYNC,            /* a = offset in buffer */
+   TR_RESYNC,          /* a = retries left */
+   TR_READ,            /* a = bytes in buffer */
+   TR_PACKET,          /* a = header bytes 1-3, b = payload offset */
+   TR_WRITE,           /* a = bytes written */
+   TR_MAX
+};
+
+#ifdef ENABLE_TRACERING
+
+extern void trring_record(unsigned int event, unsigned long long a, unsigned long long b);
+extern void trring_dump(FILE *fp);
+
+#define trring(E, A, B) \
+   trring_record(E, (unsigned long long)(A), (unsigned long long)(B))
+
+#else
+
+#define trring(E, A, B) do { } while(0)
+
+#endif /* ENABLE_TRACERING */
+
+#endif /* _TRACERING_H_ */
@@ -37,3 +37,22 @@ static char *basename(char *path)
 		);
 	return name;
 }
+
+/* XGetopt has no long options, only the short ones are parsed */
+struct option
+{
+	const char *name;
+	int has_arg;
+	int *flag;
+	int val;
+};
+
+#define no_argument		0
+#define required_argument	1
+#define optional_argument	2
+
+#define getopt_long(argc, argv, optstring, longopts, longindex) \
+	getopt(argc, argv, optstring)
+
+#define fdatasync(fd)		_commit(fd)
+#define ftruncate(fd, size)	_chsize_s(fd, size)
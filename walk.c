@@ -0,0 +1,384 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#if !defined(_MSC_VER) && !defined(LOWMEM)
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "walk.h"
+#include "stats.h"
+#include "trace.h"
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY  0
+#endif
+
+/*
+ * Create dir and its parents, like mkdir -p
+ */
+static int mkpath(const char *dir)
+{
+   char tmp[PATH_MAX];
+   char *p;
+
+   if(snprintf(tmp, sizeof(tmp), "%s", dir) >= (int)sizeof(tmp))
+      return 1;
+
+   for(p = tmp+1; *p; p++)
+   {
+      if(*p != '/')
+         continue;
+      *p = '\0';
+      if(mkdir(tmp, 0755) != 0 && errno != EEXIST)
+         return 1;
+      *p = '/';
+   }
+
+   if(mkdir(tmp, 0755) != 0 && errno != EEXIST)
+      return 1;
+
+   return 0;
+}
+
+/* "." is the root itself */
+static int walk_join(char *dst, const char *rel, const char *name)
+{
+   if(strcmp(rel, ".") == 0)
+      return snprintf(dst, PATH_MAX, "%s", name) >= PATH_MAX;
+
+   return snprintf(dst, PATH_MAX, "%s/%s", rel, name) >= PATH_MAX;
+}
+
+static void walk_pushdir(struct walk *w, int root, const char *rel)
+{
+   struct walkdir *d;
+
+   if((d = malloc(sizeof(*d))) == NULL)
+   {
+      trace(TRC_WARN, "out of memory, skipping %s", rel);
+      return;
+   }
+   d->root = root;
+   strcpy(d->rel, rel);
+
+   pthread_mutex_lock(&w->lock);
+   d->next = w->dirs;
+   w->dirs = d;
+   pthread_cond_broadcast(&w->cond);
+   pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Hand a found file to the workers, waiting while the queue is full
+ */
+static void walk_pushfile(struct walk *w, int root, const char *rel, int inf)
+{
+   pthread_mutex_lock(&w->lock);
+   while(w->count == WALK_QUEUE && !w->stop)
+      pthread_cond_wait(&w->cond, &w->lock);
+
+   if(!w->stop)
+   {
+      strcpy(w->queue[(w->head + w->count) % WALK_QUEUE], rel);
+      w->qroot[(w->head + w->count) % WALK_QUEUE] = root;
+      w->qinf[(w->head + w->count) % WALK_QUEUE] = (char)inf;
+      w->count++;
+      w->nfiles++;
+      stats_queue(1);
+      pthread_cond_broadcast(&w->cond);
+   }
+   pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Read one directory: subdirectories go back to the walkers, every
+ * .srf with a .mdb to the workers.
+ */
+static void walk_dir(struct walk *w, struct walkdir *d)
+{
+   char rel[PATH_MAX];
+   char out[PATH_MAX];
+   char mdb[NAME_MAX+1];
+   char inf[NAME_MAX+1];
+   struct dirent *de;
+   struct stat st;
+   size_t len;
+   int fd, isdir, madeout = 0;
+   DIR *dir;
+
+   if((fd = openat(w->rootfd[d->root], d->rel, O_RDONLY | O_DIRECTORY)) == -1 ||
+      (dir = fdopendir(fd)) == NULL)
+   {
+      trace(TRC_WARN, "Cannot read directory %s/%s: %s", w->root[d->root], d->rel, strerror(errno));
+      if(fd != -1)
+         close(fd);
+      return;
+   }
+
+   while((de = readdir(dir)) != NULL && !w->stop)
+   {
+      if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+         continue;
+
+      /* d_type saves a stat on most file systems, symlinks to
+         directories are not followed so a loop cannot trap us */
+#ifdef DT_DIR
+      if(de->d_type == DT_DIR)
+         isdir = 1;
+      else if(de->d_type == DT_REG || de->d_type == DT_LNK)
+         isdir = 0;
+      else
+#endif
+      {
+         if(fstatat(fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+         isdir = S_ISDIR(st.st_mode);
+      }
+
+      if(walk_join(rel, d->rel, de->d_name) != 0)
+      {
+         trace(TRC_WARN, "path too long: %s/%s", d->rel, de->d_name);
+         continue;
+      }
+
+      if(isdir)
+      {
+         walk_pushdir(w, d->root, rel);
+         continue;
+      }
+
+      len = strlen(de->d_name);
+      if(len < 5 || strcmp(de->d_name + len - 4, ".srf") != 0)
+         continue;
+
+      /* the key is required, the .inf only names the output */
+      snprintf(mdb, sizeof(mdb), "%.*s.mdb", (int)(len - 4), de->d_name);
+      if(fstatat(fd, mdb, &st, 0) != 0)
+      {
+         trace(TRC_WARN, "%s/%s has no .mdb, skipped", w->root[d->root], rel);
+         continue;
+      }
+      snprintf(inf, sizeof(inf), "%.*s.inf", (int)(len - 4), de->d_name);
+
+      if(w->outroot != NULL && !madeout)
+      {
+         if(strcmp(d->rel, ".") == 0)
+            len = snprintf(out, sizeof(out), "%s", w->outroot);
+         else
+            len = snprintf(out, sizeof(out), "%s/%s", w->outroot, d->rel);
+         if(len >= sizeof(out) || mkpath(out) != 0)
+            trace(TRC_WARN, "Cannot create %s: %s", out, strerror(errno));
+         madeout = 1;
+      }
+
+      walk_pushfile(w, d->root, rel, fstatat(fd, inf, &st, 0) == 0);
+   }
+
+   closedir(dir);
+}
+
+static void *walk_thread(void *arg)
+{
+   struct walk *w = arg;
+   struct walkdir *d;
+
+   pthread_mutex_lock(&w->lock);
+   for(;;)
+   {
+      while(w->dirs == NULL && w->busy > 0 && !w->stop)
+         pthread_cond_wait(&w->cond, &w->lock);
+
+      if(w->stop || (w->dirs == NULL && w->busy == 0))
+         break;
+
+      d = w->dirs;
+      w->dirs = d->next;
+      w->busy++;
+      pthread_mutex_unlock(&w->lock);
+
+      walk_dir(w, d);
+      free(d);
+
+      pthread_mutex_lock(&w->lock);
+      w->busy--;
+      w->ndirs++;
+      pthread_cond_broadcast(&w->cond);
+   }
+
+   w->done = 1;
+   pthread_cond_broadcast(&w->cond);
+   pthread_mutex_unlock(&w->lock);
+
+   return NULL;
+}
+
+/*
+ * Open the roots and start the walkers
+ */
+int walk_start(struct walk *w, char **roots, int nroots, const char *outroot)
+{
+   size_t len;
+   int i;
+
+   memset(w, 0, sizeof(*w));
+   pthread_mutex_init(&w->lock, NULL);
+   pthread_cond_init(&w->cond, NULL);
+   w->outroot = outroot;
+
+   if(nroots > WALK_ROOTS)
+   {
+      trace(TRC_ERROR, "At most %d directories with -r", WALK_ROOTS);
+      return 1;
+   }
+
+   if((w->queue = malloc(WALK_QUEUE * sizeof(*w->queue))) == NULL)
+      return 1;
+
+   for(i=0; i < nroots; i++)
+   {
+      len = strlen(roots[i]);
+      while(len > 1 && roots[i][len-1] == '/')
+         roots[i][--len] = '\0';
+
+      if((w->rootfd[i] = open(roots[i], O_RDONLY | O_DIRECTORY)) == -1)
+      {
+         trace(TRC_ERROR, "Cannot open directory %s: %s", roots[i], strerror(errno));
+         return 1;
+      }
+      w->root[i] = roots[i];
+      w->nroots++;
+      walk_pushdir(w, i, ".");
+   }
+
+   for(i=0; i < WALK_THREADS; i++)
+   {
+      if(pthread_create(&w->tids[i], NULL, walk_thread, w) != 0)
+         break;
+      w->nthreads++;
+   }
+
+   if(w->nthreads == 0)
+   {
+      trace(TRC_ERROR, "Cannot start directory walker");
+      return 1;
+   }
+
+   return 0;
+}
+
+/*
+ * Next found file, waiting for the walkers if none is queued. 0 once
+ * the walk is complete and everything was handed out.
+ */
+int walk_next(struct walk *w, struct mentry *e)
+{
+   char *rel, *slash;
+   size_t len;
+   int root;
+
+   pthread_mutex_lock(&w->lock);
+   while(w->count == 0 && !w->done)
+      pthread_cond_wait(&w->cond, &w->lock);
+
+   if(w->count == 0)
+   {
+      pthread_mutex_unlock(&w->lock);
+      return 0;
+   }
+
+   rel = w->queue[w->head];
+   root = w->qroot[w->head];
+
+   memset(e, 0, sizeof(*e));
+   snprintf(e->file, sizeof(e->file), "%s/%s", w->root[root], rel);
+
+   /* the names the walk found, the .srf suffix is replaced */
+   len = strlen(e->file) - 4;
+   snprintf(e->mdbfile, sizeof(e->mdbfile), "%.*s.mdb", (int)len, e->file);
+   if(w->qinf[w->head])
+      snprintf(e->inffile, sizeof(e->inffile), "%.*s.inf", (int)len, e->file);
+   e->paired = 1;
+   if(w->outroot != NULL)
+   {
+      if((slash = strrchr(rel, '/')) != NULL)
+         snprintf(e->outdir, sizeof(e->outdir), "%s/%.*s/", w->outroot, (int)(slash - rel), rel);
+      else
+         snprintf(e->outdir, sizeof(e->outdir), "%s/", w->outroot);
+   }
+
+   w->head = (w->head + 1) % WALK_QUEUE;
+   w->count--;
+   pthread_cond_broadcast(&w->cond);
+   pthread_mutex_unlock(&w->lock);
+
+   return 1;
+}
+
+/*
+ * Stop the walkers, also when the batch ended early, and clean up
+ */
+void walk_finish(struct walk *w)
+{
+   struct walkdir *d;
+   int i;
+
+   pthread_mutex_lock(&w->lock);
+   w->stop = 1;
+   pthread_cond_broadcast(&w->cond);
+   pthread_mutex_unlock(&w->lock);
+
+   for(i=0; i < w->nthreads; i++)
+      pthread_join(w->tids[i], NULL);
+
+   while((d = w->dirs) != NULL)
+   {
+      w->dirs = d->next;
+      free(d);
+   }
+
+   for(i=0; i < w->nroots; i++)
+      close(w->rootfd[i]);
+
+   trace(TRC_INFO, "Found %lu recordings in %lu directories", w->nfiles, w->ndirs);
+
+   free(w->queue);
+   w->queue = NULL;
+}
+
+#else
+
+/* the walk queues directories on the heap, so not with LOWMEM */
+
+#include "walk.h"
+#include "trace.h"
+
+int walk_start(struct walk *w, char **roots, int nroots, const char *outroot)
+{
+   trace(TRC_ERROR, "-r is not supported in this build");
+   return 1;
+}
+
+int walk_next(struct walk *w, struct mentry *e)
+{
+   return 0;
+}
+
+void walk_finish(struct walk *w)
+{
+}
+
+#endif
@@ -0,0 +1,65 @@
+/* drmdecrypt -- DRM decrypting tool for Samsung TVs
+ *
+ * Copyright (C) 2014 - Bernhard Froehlich <decke@bluelife.at>
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the GPL v2 license.  See the LICENSE file for details.
+ */
+
+#ifndef _WALK_H_
+#define _WALK_H_
+
+#include <limits.h>
+#include <pthread.h>
+
+#include "manifest.h"
+
+/*
+ * Recursive directory mode (-r). WALK_THREADS threads read directories
+ * in parallel, relative to a descriptor of the root with openat() and
+ * fstatat(), so deep trees cost no path lookups from /. Every .srf
+ * that has its .mdb next to it becomes a job as soon as it is found,
+ * with the .mdb and .inf paths the walk paired it with;
+ * the decrypt workers take them from a small queue while the walk is
+ * still going. With an output directory the tree is mirrored there.
+ */
+#define WALK_THREADS  4
+#define WALK_QUEUE    64      /* found files waiting for a worker */
+#define WALK_ROOTS    16
+
+struct walkdir
+{
+   int root;
+   char rel[PATH_MAX];        /* relative to the root, "." for itself */
+   struct walkdir *next;
+};
+
+struct walk
+{
+   int nroots;
+   int rootfd[WALK_ROOTS];
+   const char *root[WALK_ROOTS];
+   const char *outroot;       /* NULL to write next to the input */
+   struct walkdir *dirs;      /* directories left to read */
+   int busy;                  /* walkers reading a directory */
+   int done;
+   int stop;
+   char (*queue)[PATH_MAX];   /* ring of found files, relative paths */
+   int qroot[WALK_QUEUE];     /* and their roots */
+   char qinf[WALK_QUEUE];     /* and whether they have a .inf */
+   int head;
+   int count;
+   unsigned long nfiles;
+   unsigned long ndirs;
+   int nthreads;
+   pthread_t tids[WALK_THREADS];
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+};
+
+extern int walk_start(struct walk *w, char **roots, int nroots, const char *outroot);
+extern int walk_next(struct walk *w, struct mentry *e);
+extern void walk_finish(struct walk *w);
+
+#endif /* _WALK_H_ */